@@ -0,0 +1,180 @@
+/*******************************************************************
+    Gets the tempo, energy and mood of the current track, e.g. to
+        drive an LED animation. Each track is only looked up
+        once, and the queued track is looked up ahead of time.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+unsigned long delayBetweenRequests = 10000; // Time between requests (10 seconds)
+unsigned long requestDueTime;               //time when request due
+
+char lastTrackUri[SPOTIFY_URI_CHAR_LENGTH];
+char trackUri[SPOTIFY_URI_CHAR_LENGTH];
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+
+    // Look up the queued track's features while we're at it
+    spotify.prefetchAudioFeatures = true;
+}
+
+void storeTrackUri(CurrentlyPlaying currentlyPlaying)
+{
+    // The request has to be finished before making another one,
+    // so just keep the URI for now
+    if (currentlyPlaying.trackUri != NULL)
+    {
+        strncpy(trackUri, currentlyPlaying.trackUri, sizeof(trackUri) - 1);
+    }
+}
+
+void printAudioFeatures(const SpotifyAudioFeatures &features)
+{
+    Serial.println("--------- Audio Features ---------");
+    Serial.print("Tempo: ");
+    Serial.print(features.tempo);
+    Serial.println(" bpm");
+    Serial.print("Energy: ");
+    Serial.println(features.energy);
+    Serial.print("Danceability: ");
+    Serial.println(features.danceability);
+    Serial.print("Valence: ");
+    Serial.println(features.valence);
+    Serial.print("Loudness: ");
+    Serial.print(features.loudness);
+    Serial.println(" dB");
+    Serial.print("Key: ");
+    Serial.print(features.key);
+    Serial.println(features.mode == 1 ? " major" : " minor");
+    Serial.println("------------------------");
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        int status = spotify.getCurrentlyPlaying(storeTrackUri);
+        if (status == 200 && strcmp(trackUri, lastTrackUri) != 0)
+        {
+            strcpy(lastTrackUri, trackUri);
+
+            // Free if it was preloaded, otherwise one request
+            SpotifyAudioFeatures features;
+            int featuresStatus = spotify.getAudioFeatures(trackUri, &features);
+            if (featuresStatus == 200)
+            {
+                printAudioFeatures(features);
+            }
+            else
+            {
+                Serial.print("No audio features: ");
+                Serial.println(featuresStatus);
+            }
+
+            // Features (and art) for whatever is up next
+            spotify.prefetchNextAlbumArt();
+        }
+
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+}
@@ -0,0 +1,158 @@
+/*******************************************************************
+    Shows how much smaller the currently playing response gets
+        when a market is passed, using the market the library
+        looks up for you. Prints the size of each to the serial monitor.
+
+    Without a market Spotify lists every country the track and album
+    are available in, which is most of the response.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+unsigned long delayBetweenRequests = 30000; // Time between requests (30 seconds)
+unsigned long requestDueTime;               //time when request due
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+
+    // Looks up your country from /v1/me the first time it's needed (needs the
+    // user-read-private scope, otherwise "from_token" is used instead).
+    // If you already know it you can skip the lookup with spotify.setMarket("IE");
+    spotify.autoMarket = true;
+}
+
+void currentlyPlayingUpdated(CurrentlyPlaying currentlyPlaying)
+{
+    Serial.print("Track: ");
+    Serial.println(currentlyPlaying.trackName);
+}
+
+void printBodySize(const char *label)
+{
+    Serial.print(label);
+    Serial.print(spotify.stats.lastBodySize);
+    Serial.println(" bytes");
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        // Passing a market explicitly always wins, so this is what every poll
+        // used to look like with no market at all
+        spotify.autoMarket = false;
+        if (spotify.getCurrentlyPlaying(currentlyPlayingUpdated) == 200)
+        {
+            printBodySize("Without market: ");
+        }
+
+        spotify.autoMarket = true;
+        if (spotify.getCurrentlyPlaying(currentlyPlayingUpdated) == 200)
+        {
+            Serial.print("Market: ");
+            Serial.println(spotify.getMarket());
+            printBodySize("With market: ");
+        }
+
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+}
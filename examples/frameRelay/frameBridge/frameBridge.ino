@@ -0,0 +1,200 @@
+/*******************************************************************
+    Polls Spotify and passes the playback state on to other boards
+        as compact binary frames over a serial port, see the
+        frameDisplay example for the other end.
+
+    Wiring: this board's TX pin (GPIO17 on an ESP32, GPIO2 on
+    an ESP8266) to the RX pin of each display board, and GND to GND.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <SpotifyFrame.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+#if defined(ESP32)
+#define FRAME_PORT Serial2
+#else
+#define FRAME_PORT Serial1 // TX only, on GPIO2
+#endif
+
+#define FRAME_START 0x7E
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+SpotifyFrameEncoder encoder;
+uint8_t frame[512];
+
+unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+unsigned long requestDueTime;              //time when request due
+
+unsigned long delayBetweenFullFrames = 30000; // Displays that missed a frame or just started catch up within 30 seconds
+unsigned long fullFrameDueTime;
+
+void setup()
+{
+
+    Serial.begin(115200);
+    FRAME_PORT.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+void sendFrame(size_t length)
+{
+    // A start byte and the length, so the display can find where frames begin
+    FRAME_PORT.write(FRAME_START);
+    FRAME_PORT.write(length & 0xFF);
+    FRAME_PORT.write(length >> 8);
+    FRAME_PORT.write(frame, length);
+
+    Serial.print("Sent a frame of ");
+    Serial.print(length);
+    Serial.println(" bytes");
+}
+
+void sendState(PlayerDetails playerDetails, CurrentlyPlaying currentlyPlaying)
+{
+    bool full = millis() > fullFrameDueTime;
+    if (full)
+    {
+        fullFrameDueTime = millis() + delayBetweenFullFrames;
+    }
+
+    size_t length = full ? encoder.encode(currentlyPlaying, frame, sizeof(frame)) : encoder.encodeDelta(currentlyPlaying, frame, sizeof(frame));
+    if (length > SPOTIFY_FRAME_HEADER_LENGTH)
+    {
+        sendFrame(length);
+    }
+
+    length = full ? encoder.encode(playerDetails, frame, sizeof(frame)) : encoder.encodeDelta(playerDetails, frame, sizeof(frame));
+    if (length > SPOTIFY_FRAME_HEADER_LENGTH)
+    {
+        sendFrame(length);
+    }
+}
+
+// The currently playing callback is called after the player details one
+PlayerDetails lastPlayerDetails;
+
+void storePlayerDetails(PlayerDetails playerDetails)
+{
+    lastPlayerDetails = playerDetails;
+}
+
+void relayCurrentlyPlaying(CurrentlyPlaying currentlyPlaying)
+{
+    sendState(lastPlayerDetails, currentlyPlaying);
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        // Everything for both frames in one request
+        int status = spotify.getPlayerState(storePlayerDetails, relayCurrentlyPlaying);
+        if (status == 204)
+        {
+            Serial.println("Doesn't seem to be anything playing");
+        }
+        else if (status != 200)
+        {
+            Serial.print("Error: ");
+            Serial.println(status);
+        }
+
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+}
@@ -0,0 +1,164 @@
+/*******************************************************************
+    Shows what's playing, as sent by the frameBridge example,
+        without needing WiFi or a Spotify account of its own.
+        Frames are read in place, there's no JSON to parse.
+
+    Wiring: the bridge's TX pin to this board's RX pin (GPIO16 on
+    an ESP32, the normal RX pin on an ESP8266), and GND to GND.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+#include <SpotifyFrame.h>
+
+#include <ArduinoJson.h>
+// Needed by the library, but nothing here is parsed as JSON
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+#if defined(ESP32)
+#define FRAME_PORT Serial2
+#else
+#define FRAME_PORT Serial // Shares the pins with the USB serial
+#endif
+
+#define FRAME_START 0x7E
+
+SpotifyFrameDecoder decoder;
+uint8_t frame[512];
+size_t frameLength = 0;
+size_t received = 0;
+int headerBytes = -1; // -1 while waiting for a start byte
+
+// Only what's needed to draw, copied out of each frame
+char trackName[SPOTIFY_NAME_CHAR_LENGTH];
+char artistName[SPOTIFY_NAME_CHAR_LENGTH];
+char deviceName[SPOTIFY_DEVICE_NAME_CHAR_LENGTH];
+CurrentlyPlaying currentlyPlaying;
+PlayerDetails playerDetails;
+
+void setup()
+{
+    Serial.begin(115200);
+#if defined(ESP32)
+    FRAME_PORT.begin(115200);
+#endif
+}
+
+void copyString(char *destination, const char *source, size_t size)
+{
+    strncpy(destination, source != NULL ? source : "", size - 1);
+    destination[size - 1] = '\0';
+}
+
+void showFrame()
+{
+    if (!decoder.decode(frame, frameLength, currentlyPlaying, playerDetails))
+    {
+        Serial.println("Bad frame");
+        return;
+    }
+
+    // Strings point into frame, which the next frame overwrites
+    if (decoder.has(frame_track_name))
+    {
+        copyString(trackName, currentlyPlaying.trackName, sizeof(trackName));
+        Serial.print("Track: ");
+        Serial.println(trackName);
+    }
+    if (decoder.has(frame_artists))
+    {
+        copyString(artistName, currentlyPlaying.numArtists > 0 ? currentlyPlaying.artists[0].artistName : NULL, sizeof(artistName));
+        Serial.print("Artist: ");
+        Serial.println(artistName);
+    }
+    if (decoder.has(frame_device_name))
+    {
+        copyString(deviceName, playerDetails.device.name, sizeof(deviceName));
+        Serial.print("Playing on: ");
+        Serial.println(deviceName);
+    }
+    if (decoder.has(frame_volume))
+    {
+        Serial.print("Volume: ");
+        Serial.println(playerDetails.device.volumePercent);
+    }
+    if (decoder.has(frame_is_playing))
+    {
+        Serial.println(currentlyPlaying.isPlaying ? "Playing" : "Paused");
+    }
+    if (decoder.has(frame_progress))
+    {
+        Serial.print("Progress: ");
+        Serial.print(currentlyPlaying.progressMs / 1000);
+        Serial.println("s");
+    }
+
+    if (decoder.missedFrame)
+    {
+        Serial.println("Missed a frame, some of this may be out of date until the next full one");
+    }
+}
+
+void loop()
+{
+    while (FRAME_PORT.available())
+    {
+        uint8_t b = FRAME_PORT.read();
+        if (headerBytes < 0)
+        {
+            if (b == FRAME_START)
+            {
+                headerBytes = 0;
+                frameLength = 0;
+                received = 0;
+            }
+        }
+        else if (headerBytes < 2)
+        {
+            // Two byte length, low byte first
+            frameLength |= (size_t)b << (8 * headerBytes);
+            headerBytes++;
+            if (headerBytes == 2 && (frameLength == 0 || frameLength > sizeof(frame)))
+            {
+                headerBytes = -1;
+            }
+        }
+        else
+        {
+            frame[received++] = b;
+            if (received == frameLength)
+            {
+                showFrame();
+                headerBytes = -1;
+            }
+        }
+    }
+}
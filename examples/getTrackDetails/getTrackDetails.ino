@@ -0,0 +1,219 @@
+/*******************************************************************
+    Looks up the names, artists and album art of a list of tracks
+        (e.g. ones saved to buttons) in a single request, instead
+        of one request per track.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+// Up to 50 tracks are looked up per request, 20 for albums
+const char *trackUris[] = {
+    "spotify:track:4uLU6hMCjMI75M1A2tKUQC",
+    "spotify:track:7GhIk7Il098yCjg4BQjzvb",
+    "spotify:track:2TpxZ7JUBn3uw46aR7qd6V",
+    "spotify:track:4uLU6hMCjMI75M1A2tKUQC", // Duplicates are only requested once
+};
+
+#define NUM_SAVED_TRACKS 10
+char savedTrackIds[NUM_SAVED_TRACKS][SPOTIFY_TRACK_ID_CHAR_LENGTH];
+int numSavedTracks = 0;
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+#if defined(ESP32)
+    // Lookups are the biggest responses, so they gain the most from gzip.
+    // A response can refer back to anything already sent, so with up to 50
+    // tracks per request the window needs most of the 32KB deflate allows,
+    // which is the default. That is more than an ESP8266 can usually spare.
+    if (!spotify.useGzip())
+    {
+        Serial.println("Not enough memory for gzip, responses will be uncompressed");
+    }
+#endif
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+bool isTrackSaved(const char *id)
+{
+    for (int i = 0; i < numSavedTracks; i++)
+    {
+        if (strcmp(savedTrackIds[i], id) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool printTrackDetails(SpotifyTrackDetails track, int index, int numTracks)
+{
+    Serial.print(index + 1);
+    Serial.print("/");
+    Serial.print(numTracks);
+    Serial.print(": ");
+    Serial.print(track.name);
+    Serial.print(" - ");
+    for (int i = 0; i < track.numArtists; i++)
+    {
+        if (i > 0)
+        {
+            Serial.print(", ");
+        }
+        Serial.print(track.artists[i].artistName);
+    }
+    Serial.println();
+
+    Serial.print("Album: ");
+    Serial.println(track.albumName);
+    if (track.numImages > 0)
+    {
+        Serial.print("Smallest image: ");
+        Serial.println(track.albumImages[track.numImages - 1].url);
+    }
+
+    // Only the current track is in memory, keep what you need
+    if (numSavedTracks < NUM_SAVED_TRACKS)
+    {
+        strncpy(savedTrackIds[numSavedTracks], track.id, SPOTIFY_TRACK_ID_CHAR_LENGTH - 1);
+        numSavedTracks++;
+    }
+
+    return true; // false to stop reading the rest
+}
+
+void loop()
+{
+    SpotifyIdBatch batch;
+    batch.knownCallback = isTrackSaved; // Tracks we already have are skipped
+    for (unsigned int i = 0; i < sizeof(trackUris) / sizeof(trackUris[0]); i++)
+    {
+        batch.add(trackUris[i]);
+    }
+
+    if (batch.numIds == 0)
+    {
+        Serial.println("All tracks already looked up");
+    }
+    else
+    {
+        int status = spotify.getTracks(batch, printTrackDetails);
+        if (status != 200)
+        {
+            Serial.print("Error: ");
+            Serial.println(status);
+        }
+
+        if (spotify.stats.gzipResponses > 0)
+        {
+            Serial.print("Bytes received: ");
+            Serial.print(spotify.stats.compressedBytes);
+            Serial.print(", inflated to: ");
+            Serial.println(spotify.stats.uncompressedBytes);
+        }
+        if (spotify.stats.gzipFailures > 0)
+        {
+            Serial.println("A response couldn't be inflated");
+        }
+    }
+
+    delay(60000);
+}
@@ -0,0 +1,188 @@
+/*******************************************************************
+    Polls the player with gzip compressed responses, and prints
+        how many bytes came over the air compared to the
+        uncompressed JSON.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+unsigned long delayBetweenRequests = 10000; // Time between requests (10 seconds)
+unsigned long requestDueTime;               //time when request due
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    // Without a market every track comes with the full list of countries
+    spotify.autoMarket = true;
+
+    // The window has to reach as far back as a response refers, which is never
+    // further than its uncompressed size. The default 32KB always does, a
+    // smaller one saves memory but any response that refers past it is lost
+    // and counted in spotify.stats.gzipFailures, e.g. spotify.useGzip(NULL, 16384)
+    if (!spotify.useGzip())
+    {
+        Serial.println("Not enough memory for gzip, responses will be uncompressed");
+    }
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+void printPlayerState(PlayerDetails playerDetails)
+{
+    Serial.print("Device: ");
+    Serial.print(playerDetails.device.name);
+    Serial.print(", volume: ");
+    Serial.println(playerDetails.device.volumePercent);
+}
+
+void printCurrentlyPlaying(CurrentlyPlaying currentlyPlaying)
+{
+    Serial.print("Track: ");
+    Serial.println(currentlyPlaying.trackName);
+}
+
+void printCompression()
+{
+    Serial.print("Compressed responses: ");
+    Serial.println(spotify.stats.gzipResponses);
+    Serial.print("Bytes received: ");
+    Serial.print(spotify.stats.compressedBytes);
+    Serial.print(", inflated to: ");
+    Serial.println(spotify.stats.uncompressedBytes);
+
+    if (spotify.stats.uncompressedBytes > 0)
+    {
+        Serial.print("Saved: ");
+        Serial.print(100 - (spotify.stats.compressedBytes * 100 / spotify.stats.uncompressedBytes));
+        Serial.println("%");
+    }
+
+    if (spotify.stats.gzipFailures > 0)
+    {
+        Serial.print("Responses that could not be inflated: ");
+        Serial.println(spotify.stats.gzipFailures);
+    }
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        Serial.print("Free Heap: ");
+        Serial.println(ESP.getFreeHeap());
+
+        int status = spotify.getPlayerState(printPlayerState, printCurrentlyPlaying);
+        if (status == 200)
+        {
+            printCompression();
+        }
+        else if (status == 204)
+        {
+            Serial.println("Doesn't seem to be anything playing");
+        }
+        else
+        {
+            Serial.print("Error: ");
+            Serial.println(status);
+        }
+        Serial.println();
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+}
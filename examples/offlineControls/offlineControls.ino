@@ -0,0 +1,191 @@
+/*******************************************************************
+    Player controls that keep working when the WiFi drops.
+        Commands sent while the connection is down are kept
+        in a journal and replayed once it's back, without
+        blocking on a connect for every button press.
+
+    Type these into the serial monitor:
+      n - next track
+      b - previous track
+      p - play/pause
+      + / - volume up/down
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <SpotifyCommandJournal.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+SpotifyCommandJournal journal;
+
+bool isPlaying = true;
+int volume = 50;
+
+bool wifiConnected()
+{
+    return WiFi.status() == WL_CONNECTED;
+}
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+
+    // No connects at all while the WiFi is down, and one every
+    // 15 seconds if the WiFi is up but Spotify can't be reached
+    journal.linkCheck = wifiConnected;
+    journal.retryIntervalMs = 15000;
+    // Don't replay presses from more than a minute ago
+    journal.maxAgeMs = 60000;
+    spotify.journal = &journal;
+}
+
+void printResult(bool sent)
+{
+    if (sent)
+    {
+        Serial.println("Sent");
+    }
+    else if (journal.isLinkDown())
+    {
+        Serial.print("Offline, saved for later (");
+        Serial.print(journal.size());
+        Serial.println(" waiting)");
+    }
+    else
+    {
+        Serial.println("Spotify said no");
+    }
+}
+
+void loop()
+{
+    if (Serial.available())
+    {
+        char command = Serial.read();
+        switch (command)
+        {
+        case 'n':
+            printResult(spotify.nextTrack());
+            break;
+        case 'b':
+            printResult(spotify.previousTrack());
+            break;
+        case 'p':
+            isPlaying = !isPlaying;
+            printResult(isPlaying ? spotify.play() : spotify.pause());
+            break;
+        case '+':
+        case '-':
+            volume = constrain(volume + (command == '+' ? 10 : -10), 0, 100);
+            printResult(spotify.setVolume(volume));
+            break;
+        }
+    }
+
+    // Does nothing if the journal is empty or the link is still down,
+    // otherwise sends every next and previous in the order they were
+    // pressed but five volume presses as just the final volume
+    int replayed = spotify.replayJournal();
+    if (replayed > 0)
+    {
+        Serial.print("Back online, replayed ");
+        Serial.print(replayed);
+        Serial.println(" commands");
+    }
+}
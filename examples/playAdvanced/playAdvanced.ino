@@ -197,6 +197,20 @@ void specifyTrackOfPlaylist()
     }
 }
 
+// Same as specifyTrackNumOfAlbum, but SpotifyPlayOptions builds the body
+// as it's sent, so there is no need for a big char buffer.
+void playAlbumWithOptions()
+{
+    SpotifyPlayOptions options;
+    options.contextUri = "spotify:album:2fPcSpVFVo1dXEvarNoFkB";
+    options.offsetPosition = 2;
+    options.positionMs = 30000; // Start 30 seconds in
+    if (spotify.playAdvanced(options))
+    {
+        Serial.println("sent!");
+    }
+}
+
 void setup()
 {
 
@@ -269,6 +283,9 @@ void setup()
     delay(10000);
     Serial.println("Playing specific track on Playlist");
     specifyTrackOfPlaylist();
+    delay(10000);
+    Serial.println("Playing Album using SpotifyPlayOptions");
+    playAlbumWithOptions();
 }
 
 // Example code is at end of setup
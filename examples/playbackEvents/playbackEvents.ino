@@ -0,0 +1,194 @@
+/*******************************************************************
+    Prints only the parts of your spotify playback that changed
+        (track, play/pause, volume, device, shuffle/repeat, progress)
+        to the serial monitor using an ES32 or ESP8266
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <SpotifyPlaybackTracker.h>
+// Part of the SpotifyArduino library, reports what changed between polls
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+// Country code, including this is advisable
+#define SPOTIFY_MARKET "IE"
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+SpotifyPlaybackTracker tracker;
+
+unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+unsigned long requestDueTime;              //time when request due
+
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    // If you want to enable some extra debugging
+    // uncomment the "#define SPOTIFY_DEBUG" in SpotifyArduino.h
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+
+    tracker.trackChangedCallback = trackChanged;
+    tracker.playStateChangedCallback = playStateChanged;
+    tracker.volumeChangedCallback = volumeChanged;
+    tracker.deviceChangedCallback = deviceChanged;
+    tracker.shuffleRepeatChangedCallback = shuffleRepeatChanged;
+    tracker.progressCallback = progressChanged;
+}
+
+// Each of these only gets called when the matching part of the state changed,
+// so this is where you would redraw only that part of your display.
+void trackChanged(CurrentlyPlaying currentlyPlaying)
+{
+    Serial.print("Track: ");
+    Serial.println(currentlyPlaying.trackName);
+}
+
+void playStateChanged(bool isPlaying)
+{
+    Serial.println(isPlaying ? "Playing" : "Paused");
+}
+
+void volumeChanged(int volumePercent)
+{
+    Serial.print("Volume: ");
+    Serial.println(volumePercent);
+}
+
+void deviceChanged(SpotifyDevice device)
+{
+    Serial.print("Device: ");
+    Serial.println(device.name);
+}
+
+void shuffleRepeatChanged(bool shuffleState, RepeatOptions repeatState)
+{
+    Serial.print("Shuffle: ");
+    Serial.print(shuffleState ? "On" : "Off");
+    Serial.print(", Repeat: ");
+    Serial.println(repeatState == repeat_off ? "off" : (repeatState == repeat_track ? "track" : "context"));
+}
+
+void progressChanged(long progressMs, long durationMs)
+{
+    Serial.print("Progress: ");
+    Serial.print(progressMs / 1000);
+    Serial.print("s of ");
+    Serial.print(durationMs / 1000);
+    Serial.println("s");
+}
+
+void currentlyPlayingUpdated(CurrentlyPlaying currentlyPlaying)
+{
+    tracker.update(currentlyPlaying);
+}
+
+void playerDetailsUpdated(PlayerDetails playerDetails)
+{
+    tracker.update(playerDetails);
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        spotify.getCurrentlyPlaying(currentlyPlayingUpdated, SPOTIFY_MARKET);
+        spotify.getPlayerDetails(playerDetailsUpdated, SPOTIFY_MARKET);
+
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+}
@@ -73,11 +73,34 @@ char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your sp
 
 #define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
 
+// Commands go to this device when nothing is playing anywhere
+#define FALLBACK_DEVICE "Desktop"
+
 //------- ---------------------- ------
 
 WiFiClientSecure client;
 SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
 
+void printError()
+{
+    const SpotifyError &error = spotify.getLastError();
+    Serial.print("failed: ");
+    Serial.print(error.statusCode);
+    Serial.print(" ");
+    Serial.println(error.message);
+
+    if (error.reason == reason_premium_required)
+    {
+        Serial.println("Player controls need a Spotify Premium account");
+    }
+    else if (error.reason == reason_rate_limited)
+    {
+        Serial.print("Rate limited, try again in ");
+        Serial.print(error.retryAfterSeconds);
+        Serial.println(" seconds");
+    }
+}
+
 void setup()
 {
 
@@ -117,6 +140,10 @@ void setup()
         Serial.println("Failed to get access tokens");
     }
 
+    // Handle the two most common failures without bothering the sketch
+    spotify.refreshOnUnauthorized = true;
+    spotify.fallbackDeviceName = FALLBACK_DEVICE;
+
     delay(1000);
     Serial.print("Going to start of track...");
     if (spotify.seek(0))
@@ -156,12 +183,20 @@ void setup()
     {
         Serial.println("done!");
     }
+    else
+    {
+        printError();
+    }
     delay(2000);
     Serial.print("Playing...");
     if (spotify.play())
     {
         Serial.println("done!");
     }
+    else
+    {
+        printError();
+    }
 
     delay(3000);
     Serial.print("enabling shuffle...");
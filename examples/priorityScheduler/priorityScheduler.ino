@@ -0,0 +1,236 @@
+/*******************************************************************
+    Polls the currently playing track and downloads its album art
+        to SPIFFS in the background, while a button press of
+        play/pause cuts in ahead of whatever is downloading.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+#include <FS.h>
+
+#if defined(ESP32)
+#include "SPIFFS.h"
+#endif
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <SpotifyScheduler.h>
+// Included with the library, but not included by SpotifyArduino.h
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+#define BUTTON_PIN 0 // The boot/flash button on most boards
+
+//------- ---------------------- ------
+
+#define ALBUM_ART "/album.jpg"
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+SpotifyScheduler scheduler(spotify);
+
+unsigned long delayBetweenRequests = 10000; // Time between requests (10 seconds)
+unsigned long requestDueTime;               //time when request due
+
+volatile bool buttonPressed = false;
+bool isPlaying = false;
+
+char lastAlbumUri[SPOTIFY_URI_CHAR_LENGTH];
+char imageUrl[SPOTIFY_URL_CHAR_LENGTH];
+bool newAlbum = false;
+
+void IRAM_ATTR onButton()
+{
+    buttonPressed = true;
+
+    // Cancels an art download straight away, so the command
+    // doesn't have to wait for it
+    scheduler.preempt();
+}
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    if (!SPIFFS.begin())
+    {
+        Serial.println("SPIFFS initialisation failed!");
+        while (1)
+            yield(); // Stay here twiddling thumbs waiting
+    }
+
+    pinMode(BUTTON_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), onButton, FALLING);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+void checkCurrentlyPlaying(CurrentlyPlaying currentlyPlaying)
+{
+    isPlaying = currentlyPlaying.isPlaying;
+    if (currentlyPlaying.albumUri == NULL || strcmp(currentlyPlaying.albumUri, lastAlbumUri) == 0)
+    {
+        return;
+    }
+
+    int index = SpotifyArduino::closestImageIndex(currentlyPlaying.albumImages, currentlyPlaying.numImages, 300);
+    if (index >= 0)
+    {
+        strncpy(lastAlbumUri, currentlyPlaying.albumUri, sizeof(lastAlbumUri) - 1);
+        strncpy(imageUrl, currentlyPlaying.albumImages[index].url, sizeof(imageUrl) - 1);
+        newAlbum = true;
+    }
+}
+
+// Jobs can be preempted and run again, so each one starts from scratch
+
+int pollJob(SpotifyArduino &spotify, void *context)
+{
+    return spotify.getCurrentlyPlaying(checkCurrentlyPlaying);
+}
+
+int artJob(SpotifyArduino &spotify, void *context)
+{
+    fs::File file = SPIFFS.open(ALBUM_ART, "w+");
+    if (!file)
+    {
+        return image_failed;
+    }
+    SpotifyImageResult result = spotify.getImage(imageUrl, &file);
+    file.close();
+    return result;
+}
+
+int playPauseJob(SpotifyArduino &spotify, void *context)
+{
+    bool playing = isPlaying ? !spotify.pause() : spotify.play();
+    isPlaying = playing;
+    return playing;
+}
+
+void artDone(SpotifyPriority priority, int result, void *context)
+{
+    Serial.println(result != image_failed ? "Album art downloaded" : "Album art failed");
+}
+
+void printQueueDelay(const char *name, SpotifyPriority priority)
+{
+    Serial.print(name);
+    Serial.print(" waited ");
+    Serial.print(scheduler.stats[priority].lastQueueDelayMs);
+    Serial.print("ms (max ");
+    Serial.print(scheduler.stats[priority].maxQueueDelayMs);
+    Serial.println("ms)");
+}
+
+void loop()
+{
+    if (buttonPressed)
+    {
+        buttonPressed = false;
+        scheduler.submit(priority_interactive, playPauseJob);
+    }
+
+    if (millis() > requestDueTime)
+    {
+        scheduler.submit(priority_metadata, pollJob);
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+
+    if (newAlbum)
+    {
+        newAlbum = false;
+        scheduler.submit(priority_art, artJob, NULL, artDone);
+    }
+
+    if (scheduler.run() && scheduler.stats[priority_interactive].run > 0)
+    {
+        printQueueDelay("Play/pause", priority_interactive);
+    }
+}
@@ -0,0 +1,162 @@
+/*******************************************************************
+    Polls spotify on one core while the other core "renders" at
+        30fps from a published snapshot of the playback state,
+        without the render loop ever waiting on a poll.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any dual core ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <SpotifyStatePublisher.h>
+// Part of the SpotifyArduino library, shares the latest state between cores
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+SpotifyStatePublisher publisher;
+
+unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+unsigned long frameTime = 1000 / 30;       // 30fps
+unsigned long frameDueTime;
+
+// Runs on core 0, the only task that touches spotify
+void pollTask(void *parameter)
+{
+    while (true)
+    {
+        // No callbacks needed, the publisher gets a copy of everything that's parsed
+        spotify.getCurrentlyPlaying(NULL);
+        spotify.getPlayerDetails(NULL);
+        vTaskDelay(delayBetweenRequests / portTICK_PERIOD_MS);
+    }
+}
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+    client.setCACert(spotify_server_cert);
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+
+    spotify.statePublisher = &publisher;
+    xTaskCreatePinnedToCore(pollTask, "spotifyPoll", 12288, NULL, 1, NULL, 0);
+}
+
+uint32_t lastVersion = 0;
+SpotifyPlaybackSnapshot snapshot;
+
+// loop() runs on core 1
+void loop()
+{
+    if (millis() < frameDueTime)
+    {
+        return;
+    }
+    frameDueTime = millis() + frameTime;
+
+    // Only copy the state when something changed
+    if (publisher.version() != lastVersion)
+    {
+        publisher.read(snapshot);
+        lastVersion = snapshot.version;
+
+        Serial.print(snapshot.trackName);
+        Serial.print(" - ");
+        Serial.print(snapshot.artistNames);
+        Serial.print(" on ");
+        Serial.println(snapshot.deviceName);
+    }
+
+    // Progress moves every frame even though spotify is only polled every few seconds
+    if (snapshot.hasTrack && snapshot.isPlaying)
+    {
+        long progressMs = snapshot.progressMs + (millis() - snapshot.publishedAtMs);
+        if (progressMs > snapshot.durationMs)
+        {
+            progressMs = snapshot.durationMs;
+        }
+        // drawProgressBar(progressMs, snapshot.durationMs);
+    }
+}
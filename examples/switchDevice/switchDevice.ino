@@ -0,0 +1,157 @@
+/*******************************************************************
+    Switches playback to a device by its name, using the device
+        list the library keeps so there's no need to fetch
+        the devices every time.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP8266 or ESP32 board
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+// Names as they show up in the spotify app
+char firstDeviceName[] = "Kitchen";
+char secondDeviceName[] = "Living Room";
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+unsigned long delayBetweenSwitches = 30000; // Time between switching devices (30 seconds)
+unsigned long switchDueTime;                //time when switch due
+bool onFirstDevice = false;
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+#if defined(ESP8266)
+    client.setFingerprint(SPOTIFY_FINGERPRINT); // These expire every few months
+#elif defined(ESP32)
+    client.setCACert(spotify_server_cert);
+#endif
+    // ... or don't!
+    //client.setInsecure();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+
+    // The device list is only fetched again once it's older than this
+    spotify.deviceCacheTtlMs = 5 * 60 * 1000;
+}
+
+void loop()
+{
+    if (millis() > switchDueTime)
+    {
+        onFirstDevice = !onFirstDevice;
+        const char *name = onFirstDevice ? firstDeviceName : secondDeviceName;
+
+        // Only goes to spotify if the cached list is empty or too old
+        const SpotifyCachedDevice *device = spotify.findDevice(name);
+        if (device == NULL)
+        {
+            Serial.print("Could not find ");
+            Serial.println(name);
+
+            // Maybe it was only just turned on, look again next time
+            spotify.invalidateDevices();
+        }
+        else
+        {
+            Serial.print("Switching to ");
+            Serial.print(device->name);
+            Serial.print(" (");
+            Serial.print(device->type);
+            Serial.println(")");
+
+            // A cached device can be passed anywhere a device id is taken
+            if (!spotify.transferPlayback(*device, true))
+            {
+                Serial.println("Failed to transfer playback");
+            }
+        }
+
+        switchDueTime = millis() + delayBetweenSwitches;
+    }
+}
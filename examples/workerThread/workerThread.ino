@@ -0,0 +1,161 @@
+/*******************************************************************
+    Keeps all the spotify requests on their own thread so the main
+        loop (your buttons/display) never waits on the network.
+        The button toggles play/pause, the worker also polls
+        what's playing every few seconds.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Compatible Boards:
+	  - Any ESP32 board (the ESP8266 doesn't have threads)
+
+    Parts:
+    ESP32 D1 Mini style Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affiliate
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <SpotifyArduino.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/spotify-api-arduino
+
+// including a "spotify_server_cert" variable
+// header is included as part of the SpotifyArduino libary
+#include <SpotifyArduinoCert.h>
+
+#include <SpotifyWorker.h>
+// Part of the SpotifyArduino library, runs the requests on a thread of its own
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+#define BUTTON_PIN 0 // The boot button on most dev boards
+
+//------- ---------------------- ------
+
+WiFiClientSecure client;
+SpotifyArduino spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+SpotifyWorker worker(spotify);
+
+unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+unsigned long requestDueTime;              //time when request due
+
+// Written by the worker thread, read by loop()
+volatile bool isPlaying = false;
+
+SpotifyWorkerFuture playPauseResult;
+bool waitingOnPlayPause = false;
+
+void setup()
+{
+
+    Serial.begin(115200);
+    pinMode(BUTTON_PIN, INPUT_PULLUP);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // Handle HTTPS Verification
+    client.setCACert(spotify_server_cert);
+    // ... or don't!
+    //client.setInsecure();
+
+    // From here on only the worker touches spotify
+    worker.start();
+
+    SpotifyWorkerFuture refresh;
+    int refreshed = 0;
+    if (!worker.refreshAccessToken(&refresh) || !refresh.wait(refreshed) || refreshed != 1)
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+// Called on the worker thread
+void currentlyPlayingUpdated(CurrentlyPlaying currentlyPlaying)
+{
+    isPlaying = currentlyPlaying.isPlaying;
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        // Doesn't wait, if the queue is full this poll is just skipped
+        worker.getCurrentlyPlaying(currentlyPlayingUpdated);
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+
+    if (!waitingOnPlayPause && digitalRead(BUTTON_PIN) == LOW)
+    {
+        bool queued = isPlaying ? worker.pause("", &playPauseResult) : worker.play("", &playPauseResult);
+        waitingOnPlayPause = queued;
+    }
+
+    if (waitingOnPlayPause && playPauseResult.ready())
+    {
+        waitingOnPlayPause = false;
+        if (playPauseResult.result())
+        {
+            isPlaying = !isPlaying;
+            Serial.println(isPlaying ? "Playing" : "Paused");
+        }
+        else
+        {
+            Serial.println("Play/pause failed");
+        }
+    }
+
+    // The rest of your UI goes here, nothing above ever blocks on the network
+}
@@ -19,1184 +19,3310 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
 #include "SpotifyArduino.h"
+#include "SpotifyStatePublisher.h"
+#include "SpotifyCommandJournal.h"
+
+// Top level fields each filtered parse needs, once they've all been read the rest of the body is left unread.
+// A "[0]" suffix means only the first element of that array is wanted.
+static const char *const tokenKeys[] = {"access_token", "token_type", "expires_in"};
+static const char *const authorizationKeys[] = {"access_token", "expires_in", "refresh_token"};
+static const char *const currentlyPlayingKeys[] = {"is_playing", "currently_playing_type", "progress_ms", "context", "item"};
+static const char *const playerDetailsKeys[] = {"device", "progress_ms", "is_playing", "shuffle_state", "repeat_state"};
+static const char *const playerStateKeys[] = {"device", "progress_ms", "is_playing", "shuffle_state", "repeat_state", "currently_playing_type", "context", "item"};
+static const char *const queueKeys[] = {"queue[0]"};
+static const char *const userKeys[] = {"country"};
+static const char *const devicesKeys[] = {"devices"};
+static const char *const searchKeys[] = {"tracks"};
+static const char *const audioFeaturesKeys[] = {"danceability", "energy", "key", "loudness", "mode", "valence", "tempo", "time_signature"};
+
+// Same order as SpotifyErrorReason, starting at reason_no_prev_track
+static const char *const errorReasons[] = {
+    "NO_PREV_TRACK",
+    "NO_NEXT_TRACK",
+    "NO_SPECIFIC_TRACK",
+    "ALREADY_PAUSED",
+    "NOT_PAUSED",
+    "NOT_PLAYING_LOCALLY",
+    "NOT_PLAYING_TRACK",
+    "NOT_PLAYING_CONTEXT",
+    "ENDLESS_CONTEXT",
+    "CONTEXT_DISALLOW",
+    "ALREADY_PLAYING",
+    "RATE_LIMITED",
+    "REMOTE_CONTROL_DISALLOW",
+    "DEVICE_NOT_CONTROLLABLE",
+    "VOLUME_CONTROL_DISALLOW",
+    "NO_ACTIVE_DEVICE",
+    "PREMIUM_REQUIRED"};
+
+enum SpotifyCommandValue
+{
+    value_none,
+    value_number,
+    value_bool,
+    value_repeat
+};
+
+// Everything that differs between the player commands, sendPlayerCommand
+// does the rest. The table is kept in flash.
+struct SpotifyCommandDescriptor
+{
+    char method[6];
+    char path[24];
+    char query[16]; // Parameter the value is sent in, "" for none
+    uint8_t valueType;
+    int8_t stateField; // SpotifyPlayerStateField it changes, -1 for none
+    uint8_t journalCommand;
+};
+
+// Same order as SpotifyPlayerCommand
+static const SpotifyCommandDescriptor playerCommands[] PROGMEM = {
+    {"PUT ", SPOTIFY_PLAY_ENDPOINT, "", value_none, player_state_playing, journal_play},
+    {"PUT ", SPOTIFY_PAUSE_ENDPOINT, "", value_none, player_state_playing, journal_pause},
+    {"PUT ", "/v1/me/player/volume", "volume_percent", value_number, player_state_volume, journal_volume},
+    {"PUT ", "/v1/me/player/shuffle", "state", value_bool, player_state_shuffle, journal_shuffle},
+    {"PUT ", "/v1/me/player/repeat", "state", value_repeat, player_state_repeat, journal_repeat},
+    {"POST ", SPOTIFY_NEXT_TRACK_ENDPOINT, "", value_none, -1, journal_next},
+    {"POST ", SPOTIFY_PREVIOUS_TRACK_ENDPOINT, "", value_none, -1, journal_previous},
+    {"PUT ", SPOTIFY_SEEK_ENDPOINT, "position_ms", value_number, -1, journal_seek}};
+
+// Same order as RepeatOptions
+static const char *const repeatStates[] = {"track", "context", "off"};
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_DEBUG
+#define SPOTIFY_LOG_STACK() printStack()
+#else
+#define SPOTIFY_LOG_STACK() \
+    do                      \
+    {                       \
+    } while (0)
+#endif
 
 SpotifyArduino::SpotifyArduino(Client &client)
 {
-    this->client = &client;
+    setClient(client);
 }
 
 SpotifyArduino::SpotifyArduino(Client &client, char *bearerToken)
 {
-    this->client = &client;
+    setClient(client);
     sprintf(this->_bearerToken, "Bearer %s", bearerToken);
 }
 
 SpotifyArduino::SpotifyArduino(Client &client, const char *clientId, const char *clientSecret, const char *refreshToken)
 {
-    this->client = &client;
+    setClient(client);
     this->_clientId = clientId;
     this->_clientSecret = clientSecret;
     setRefreshToken(refreshToken);
 }
 
-int SpotifyArduino::makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+void SpotifyArduino::setClient(Client &client)
 {
-    client->flush();
-#ifdef SPOTIFY_DEBUG
-    Serial.println(host);
-#endif
-    client->setTimeout(SPOTIFY_TIMEOUT);
-    if (!client->connect(host, portNumber))
-    {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.println(F("Connection failed"));
-#endif
-        return -1;
-    }
-
-    // give the esp a breather
-    yield();
-
-    // Send HTTP request
-    client->print(type);
-    client->print(command);
-    client->println(F(" HTTP/1.0"));
-
-    //Headers
-    client->print(F("Host: "));
-    client->println(host);
-
-    client->println(F("Accept: application/json"));
-    client->print(F("Content-Type: "));
-    client->println(contentType);
-
-    if (authorization != NULL)
-    {
-        client->print(F("Authorization: "));
-        client->println(authorization);
-    }
-
-    client->println(F("Cache-Control: no-cache"));
-
-    client->print(F("Content-Length: "));
-    client->println(strlen(body));
-
-    client->println();
-
-    client->print(body);
-
-    if (client->println() == 0)
-    {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.println(F("Failed to send request"));
-#endif
-        return -2;
-    }
+    _deadlineClient.setClient(&client, &stats);
+    this->client = &_deadlineClient;
+}
 
-    int statusCode = getHttpStatusCode();
-    return statusCode;
+void SpotifyDeadlineClient::setClient(Client *client, SpotifyStats *stats)
+{
+    _client = client;
+    _stats = stats;
 }
 
-int SpotifyArduino::makePutRequest(const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+void SpotifyDeadlineClient::arm(const SpotifyDeadlines &deadlines, SpotifyCancelToken *cancelToken, SpotifyTlsSessionStore *sessions)
 {
-    return makeRequestWithBody("PUT ", command, authorization, body, contentType);
+    _deadlines = deadlines;
+    _cancelToken = cancelToken;
+    _sessions = sessions;
+    end = request_completed;
+    _gotFirstByte = false;
+    _startedAt = _phaseStartedAt = millis();
 }
 
-int SpotifyArduino::makePostRequest(const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+void SpotifyDeadlineClient::disarm()
 {
-    return makeRequestWithBody("POST ", command, authorization, body, contentType, host);
+    // Leaves end alone, a request that did run out still says so
+    _deadlines = SpotifyDeadlines();
+    _cancelToken = NULL;
 }
 
-int SpotifyArduino::makeGetRequest(const char *command, const char *authorization, const char *accept, const char *host)
+bool SpotifyDeadlineClient::expired()
 {
-    client->flush();
-    client->setTimeout(SPOTIFY_TIMEOUT);
-    if (!client->connect(host, portNumber))
+    if (end != request_completed)
     {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.println(F("Connection failed"));
-#endif
-        return -1;
+        return true;
     }
 
-    // give the esp a breather
-    yield();
-
-    // Send HTTP request
-    client->print(F("GET "));
-    client->print(command);
-    client->println(F(" HTTP/1.0"));
-
-    //Headers
-    client->print(F("Host: "));
-    client->println(host);
-
-    if (accept != NULL)
+    unsigned long now = millis();
+    if (_cancelToken != NULL && _cancelToken->isCancelled())
     {
-        client->print(F("Accept: "));
-        client->println(accept);
+        end = request_cancelled;
     }
-
-    if (authorization != NULL)
+    else if (_deadlines.overallMs != 0 && now - _startedAt > _deadlines.overallMs)
     {
-        client->print(F("Authorization: "));
-        client->println(authorization);
+        end = request_overall_timeout;
     }
-
-    client->println(F("Cache-Control: no-cache"));
-
-    if (client->println() == 0)
+    else if (!_gotFirstByte && _deadlines.firstByteMs != 0 && now - _phaseStartedAt > _deadlines.firstByteMs)
     {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.println(F("Failed to send request"));
-#endif
-        return -2;
+        end = request_first_byte_timeout;
     }
-
-    int statusCode = getHttpStatusCode();
-
-    return statusCode;
-}
-
-void SpotifyArduino::setRefreshToken(const char *refreshToken)
-{
-    int newRefreshTokenLen = strlen(refreshToken);
-    if (_refreshToken == NULL || strlen(_refreshToken) < newRefreshTokenLen)
+    else if (_gotFirstByte && _deadlines.bodyMs != 0 && now - _phaseStartedAt > _deadlines.bodyMs)
     {
-        delete _refreshToken;
-        _refreshToken = new char[newRefreshTokenLen + 1]();
+        end = request_body_timeout;
     }
-
-    strncpy(_refreshToken, refreshToken, newRefreshTokenLen + 1);
-}
-
-bool SpotifyArduino::refreshAccessToken()
-{
-    char body[300];
-    sprintf(body, refreshAccessTokensBody, _refreshToken, _clientId, _clientSecret);
-
-#ifdef SPOTIFY_DEBUG
-    Serial.println(body);
-    printStack();
-#endif
-
-    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
-    if (statusCode > 0)
+    else
     {
-        skipHeaders();
+        return false;
     }
-    unsigned long now = millis();
-
-#ifdef SPOTIFY_DEBUG
-    Serial.print("status Code");
-    Serial.println(statusCode);
-#endif
 
-    bool refreshed = false;
-    if (statusCode == 200)
+    if (end == request_cancelled)
     {
-        StaticJsonDocument<48> filter;
-        filter["access_token"] = true;
-        filter["token_type"] = true;
-        filter["expires_in"] = true;
-
-        DynamicJsonDocument doc(512);
-
-        // Parse JSON object
-#ifndef SPOTIFY_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client, DeserializationOption::Filter(filter));
-#else
-        ReadLoggingStream loggingStream(*client, Serial);
-        DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
-#endif
-        if (!error)
-        {
-#ifdef SPOTIFY_DEBUG
-            Serial.println(F("No JSON error, dealing with response"));
-#endif
-            const char *accessToken = doc["access_token"].as<const char *>();
-            if (accessToken != NULL && (SPOTIFY_ACCESS_TOKEN_LENGTH >= strlen(accessToken)))
-            {
-                sprintf(this->_bearerToken, "Bearer %s", accessToken);
-                int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-                tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-                timeTokenRefreshed = now;
-                refreshed = true;
-            }
-            else
-            {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-                Serial.print(F("Problem with access_token (too long or null): "));
-                Serial.println(accessToken);
-#endif
-            }
-        }
-        else
-        {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
-#endif
-        }
+        _stats->cancellations++;
+        SPOTIFY_LOG_INFO("Request cancelled");
     }
     else
     {
-        parseError();
+        _stats->timeouts++;
+        SPOTIFY_LOG_ERROR("Request deadline passed, phase: ", (long)end);
     }
 
-    closeClient();
-    return refreshed;
+    // Stops any find/readBytes that's waiting from waiting any longer
+    setTimeout(0);
+    _client->stop();
+    return true;
 }
 
-bool SpotifyArduino::checkAndRefreshAccessToken()
+bool SpotifyDeadlineClient::checkConnect(int result)
 {
-    unsigned long timeSinceLastRefresh = millis() - timeTokenRefreshed;
-    if (timeSinceLastRefresh >= tokenTimeToLiveMs)
+    if (result && _deadlines.connectMs != 0 && millis() - _startedAt > _deadlines.connectMs)
     {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.println("Refresh of the Access token is due, doing that now.");
-#endif
-        return refreshAccessToken();
+        end = request_connect_timeout;
+        _stats->timeouts++;
+        SPOTIFY_LOG_ERROR("Connect took longer than its deadline");
+        _client->stop();
+        return false;
     }
 
-    // Token is still valid
-    return true;
+    // The first byte deadline starts once we're connected
+    _phaseStartedAt = millis();
+    return result != 0 && !expired();
 }
 
-const char *SpotifyArduino::requestAccessTokens(const char *code, const char *redirectUrl)
+void SpotifyDeadlineClient::gotData()
 {
+    if (!_gotFirstByte)
+    {
+        // From here on it's the body deadline
+        _gotFirstByte = true;
+        _phaseStartedAt = millis();
+    }
+}
 
-    char body[500];
-    sprintf(body, requestAccessTokensBody, code, redirectUrl, _clientId, _clientSecret);
-
-#ifdef SPOTIFY_DEBUG
-    Serial.println(body);
-#endif
+int SpotifyDeadlineClient::connect(IPAddress ip, uint16_t port)
+{
+    if (expired())
+    {
+        return 0;
+    }
+    return checkConnect(_client->connect(ip, port));
+}
 
-    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
-    if (statusCode > 0)
+int SpotifyDeadlineClient::connect(const char *host, uint16_t port)
+{
+    if (expired())
     {
-        skipHeaders();
+        return 0;
     }
-    unsigned long now = millis();
 
-#ifdef SPOTIFY_DEBUG
-    Serial.print("status Code");
-    Serial.println(statusCode);
-#endif
+    if (_sessions != NULL)
+    {
+        _sessions->offerSession(host);
+    }
 
-    if (statusCode == 200)
+    int result = _client->connect(host, port);
+    if (result)
     {
-        DynamicJsonDocument doc(1000);
-        // Parse JSON object
-#ifndef SPOTIFY_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client);
-#else
-        ReadLoggingStream loggingStream(*client, Serial);
-        DeserializationError error = deserializeJson(doc, loggingStream);
-#endif
-        if (!error)
+        if (_sessions != NULL && _sessions->saveSession(host))
         {
-            sprintf(this->_bearerToken, "Bearer %s", doc["access_token"].as<const char *>());
-            setRefreshToken(doc["refresh_token"].as<const char *>());
-            int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-            tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-            timeTokenRefreshed = now;
+            _stats->tlsResumedHandshakes++;
         }
         else
         {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
-#endif
+            _stats->tlsFullHandshakes++;
         }
     }
-    else
-    {
-        parseError();
-    }
-
-    closeClient();
-    return _refreshToken;
+    return checkConnect(result);
 }
 
-bool SpotifyArduino::play(const char *deviceId)
+size_t SpotifyDeadlineClient::write(uint8_t b)
 {
-    char command[100] = SPOTIFY_PLAY_ENDPOINT;
-    return playerControl(command, deviceId);
+    return expired() ? 0 : _client->write(b);
 }
 
-bool SpotifyArduino::playAdvanced(char *body, const char *deviceId)
+size_t SpotifyDeadlineClient::write(const uint8_t *buf, size_t size)
 {
-    char command[100] = SPOTIFY_PLAY_ENDPOINT;
-    return playerControl(command, deviceId, body);
+    return expired() ? 0 : _client->write(buf, size);
 }
 
-bool SpotifyArduino::pause(const char *deviceId)
+int SpotifyDeadlineClient::available()
 {
-    char command[100] = SPOTIFY_PAUSE_ENDPOINT;
-    return playerControl(command, deviceId);
+    return expired() ? 0 : _client->available();
 }
 
-bool SpotifyArduino::setVolume(int volume, const char *deviceId)
+int SpotifyDeadlineClient::read()
 {
-    char command[125];
-    sprintf(command, SPOTIFY_VOLUME_ENDPOINT, volume);
-    return playerControl(command, deviceId);
+    if (expired())
+    {
+        return -1;
+    }
+
+    int c = _client->read();
+    if (c >= 0)
+    {
+        gotData();
+    }
+    return c;
 }
 
-bool SpotifyArduino::toggleShuffle(bool shuffle, const char *deviceId)
+int SpotifyDeadlineClient::read(uint8_t *buf, size_t size)
 {
-    char command[125];
-    char shuffleState[10];
-    if (shuffle)
+    if (expired())
     {
-        strcpy(shuffleState, "true");
+        return -1;
     }
-    else
+
+    int amount = _client->read(buf, size);
+    if (amount > 0)
     {
-        strcpy(shuffleState, "false");
+        gotData();
     }
-    sprintf(command, SPOTIFY_SHUFFLE_ENDPOINT, shuffleState);
-    return playerControl(command, deviceId);
+    return amount;
 }
 
-bool SpotifyArduino::setRepeatMode(RepeatOptions repeat, const char *deviceId)
+int SpotifyDeadlineClient::peek()
 {
-    char command[125];
-    char repeatState[10];
-    switch (repeat)
-    {
-    case repeat_track:
-        strcpy(repeatState, "track");
-        break;
-    case repeat_context:
-        strcpy(repeatState, "context");
-        break;
-    case repeat_off:
-        strcpy(repeatState, "off");
-        break;
-    }
+    return expired() ? -1 : _client->peek();
+}
 
-    sprintf(command, SPOTIFY_REPEAT_ENDPOINT, repeatState);
-    return playerControl(command, deviceId);
+uint8_t SpotifyDeadlineClient::connected()
+{
+    return !expired() && _client->connected();
 }
 
-bool SpotifyArduino::playerControl(char *command, const char *deviceId, const char *body)
+void SpotifyArduino::armDeadlines(const char *type, const char *command, const char *host)
 {
-    if (deviceId[0] != 0)
+    SpotifyEndpointClass endpoint = endpoint_other;
+    if (strcmp(host, SPOTIFY_ACCOUNTS_HOST) == 0)
     {
-        char *questionMarkPointer;
-        questionMarkPointer = strchr(command, '?');
-        char deviceIdBuff[50];
-        if (questionMarkPointer == NULL)
-        {
-            sprintf(deviceIdBuff, "?device_id=%s", deviceId);
-        }
-        else
-        {
-            // params already started
-            sprintf(deviceIdBuff, "&device_id=%s", deviceId);
-        }
-        strcat(command, deviceIdBuff);
+        endpoint = endpoint_token;
     }
-
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-    Serial.println(body);
-#endif
-
-    if (autoTokenRefresh)
+    else if (strcmp(host, SPOTIFY_HOST) != 0)
     {
-        checkAndRefreshAccessToken();
+        endpoint = endpoint_image;
+    }
+    else if (strncmp(command, SPOTIFY_DEVICES_ENDPOINT, sizeof(SPOTIFY_DEVICES_ENDPOINT) - 1) == 0)
+    {
+        endpoint = endpoint_devices;
+    }
+    else if (strncmp(command, SPOTIFY_SEARCH_ENDPOINT, sizeof(SPOTIFY_SEARCH_ENDPOINT) - 1) == 0)
+    {
+        endpoint = endpoint_search;
+    }
+    else if (strncmp(command, SPOTIFY_PLAYER_ENDPOINT, sizeof(SPOTIFY_PLAYER_ENDPOINT) - 1) == 0)
+    {
+        endpoint = (type[0] == 'G') ? endpoint_player_state : endpoint_player_control;
     }
-    int statusCode = makePutRequest(command, _bearerToken, body);
 
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+    _deadlineClient.arm(deadlines[endpoint], cancelToken, tlsSessions);
 }
 
-bool SpotifyArduino::playerNavigate(char *command, const char *deviceId)
+unsigned long SpotifyArduino::worstCaseMs(SpotifyEndpointClass endpoint)
 {
-    if (deviceId[0] != 0)
+    // The longest one request can hold up the caller, 0 if it's unbounded.
+    // A request that needs a token refresh first adds the endpoint_token case on top.
+    const SpotifyDeadlines &budget = deadlines[endpoint];
+    unsigned long phases = 0;
+    if (budget.connectMs != 0 && budget.firstByteMs != 0 && budget.bodyMs != 0)
     {
-        char deviceIdBuff[50];
-        sprintf(deviceIdBuff, "?device_id=%s", deviceId);
-        strcat(command, deviceIdBuff);
+        phases = budget.connectMs + budget.firstByteMs + budget.bodyMs;
     }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-
-    if (autoTokenRefresh)
+    if (budget.overallMs != 0 && (phases == 0 || budget.overallMs < phases))
     {
-        checkAndRefreshAccessToken();
+        return budget.overallMs;
     }
-    int statusCode = makePostRequest(command, _bearerToken);
-
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+    return phases;
 }
 
-bool SpotifyArduino::nextTrack(const char *deviceId)
+bool SpotifyJsonArena::begin(uint8_t *memory, size_t size)
 {
-    char command[100] = SPOTIFY_NEXT_TRACK_ENDPOINT;
-    return playerNavigate(command, deviceId);
-}
+    if (_inUse)
+    {
+        return false;
+    }
 
-bool SpotifyArduino::previousTrack(const char *deviceId)
+    if (memory == NULL)
+    {
+        memory = (uint8_t *)malloc(size);
+        if (memory == NULL)
+        {
+            SPOTIFY_LOG_ERROR("Could not allocate the JSON arena");
+            return false;
+        }
+    }
+
+    _memory = memory;
+    _size = size;
+    return true;
+}
+
+void *SpotifyJsonArena::allocate(size_t size)
+{
+    if (_memory == NULL)
+    {
+        return malloc(size);
+    }
+
+    // A NULL here leaves the document with no room, the parse fails with NoMemory
+    if (_inUse)
+    {
+        SPOTIFY_LOG_ERROR("JSON arena is already in use, was a request made from a callback?");
+        return NULL;
+    }
+    if (size > _size)
+    {
+        SPOTIFY_LOG_ERROR("JSON arena is too small, bytes needed: ", (long)size);
+        return NULL;
+    }
+
+    _inUse = true;
+    return _memory;
+}
+
+void SpotifyJsonArena::deallocate(void *pointer)
+{
+    if (pointer != NULL && pointer == _memory)
+    {
+        _inUse = false;
+    }
+    else
+    {
+        free(pointer);
+    }
+}
+
+void *SpotifyJsonArena::reallocate(void *pointer, size_t size)
+{
+    if (pointer != NULL && pointer == _memory)
+    {
+        // Shrinking in place is fine, growing past the arena isn't
+        return size <= _size ? pointer : NULL;
+    }
+    return realloc(pointer, size);
+}
+
+size_t SpotifyArduino::jsonArenaSizeNeeded()
+{
+    const int sizes[] = {currentlyPlayingBufferSize, playerDetailsBufferSize, getDevicesBufferSize, searchDetailsBufferSize, queueBufferSize, lookupItemBufferSize, SPOTIFY_TOKEN_DOC_SIZE};
+    int largest = 0;
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        if (sizes[i] > largest)
+        {
+            largest = sizes[i];
+        }
+    }
+    return largest;
+}
+
+bool SpotifyArduino::useJsonArena(uint8_t *memory, size_t size)
+{
+    size_t needed = jsonArenaSizeNeeded();
+    if (size == 0)
+    {
+        size = needed;
+    }
+
+    if (size < needed)
+    {
+        SPOTIFY_LOG_ERROR("JSON arena is smaller than the biggest document, bytes needed: ", (long)needed);
+        return false;
+    }
+
+    return _jsonArena.begin(memory, size);
+}
+
+bool SpotifyArduino::useGzip(uint8_t *window, size_t size)
+{
+    if (_inflater != NULL)
+    {
+        SPOTIFY_LOG_ERROR("Gzip is already on");
+        return false;
+    }
+
+    _inflater = new SpotifyInflateStream(window, size);
+    if (_inflater == NULL || !_inflater->valid())
+    {
+        SPOTIFY_LOG_ERROR("Could not allocate the gzip window, bytes needed: ", (long)size);
+        delete _inflater;
+        _inflater = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool SpotifyArduino::linkAvailable()
+{
+    if (journal == NULL || journal->canConnect())
+    {
+        return true;
+    }
+
+    // Known to be down, failing now saves waiting out another connect
+    stats.connectsSkipped++;
+    SPOTIFY_LOG_DEBUG("Link down, not connecting");
+    return false;
+}
+
+void SpotifyArduino::connectFailed()
+{
+    SPOTIFY_LOG_ERROR("Connection failed");
+    if (journal != NULL && _deadlineClient.end != request_cancelled)
+    {
+        journal->linkFailed();
+    }
+}
+
+void SpotifyArduino::journalCommand(int command, long value, const char *deviceId)
+{
+    // Only commands that never reached Spotify, one it turned down stays turned down
+    if (journal != NULL && journal->isLinkDown())
+    {
+        journal->record((SpotifyJournalCommand)command, value, deviceId);
+    }
+}
+
+int SpotifyArduino::replayJournal()
+{
+    if (journal == NULL || journal->size() == 0)
+    {
+        return 0;
+    }
+
+    if (!journal->canConnect())
+    {
+        return -1;
+    }
+
+    // Anything that fails again goes straight back into the journal, behind
+    // the entries being replayed, so each is only tried once here
+    int count = journal->compact();
+    SPOTIFY_LOG_INFO("Replaying journal, commands: ", (long)count);
+    int sent = 0;
+    SpotifyJournalEntry entry;
+    for (int i = 0; i < count && journal->take(entry); i++)
+    {
+        if (entry.command == journal_transfer)
+        {
+            sent += transferPlayback(entry.deviceId, entry.value != 0);
+        }
+        else
+        {
+            sent += sendPlayerCommand((SpotifyPlayerCommand)entry.command, entry.value, entry.deviceId);
+        }
+    }
+
+    return sent;
+}
+
+SpotifyBodyStream::SpotifyBodyStream(Client *client)
+{
+    _client = client;
+    begin(-1, false);
+}
+
+void SpotifyBodyStream::begin(long contentLength, bool chunked)
+{
+    _chunked = chunked;
+    _remaining = chunked ? 0 : contentLength;
+    _done = (!chunked && contentLength == 0);
+}
+
+int SpotifyBodyStream::available()
+{
+    if (!prepare())
+    {
+        return 0;
+    }
+
+    int size = _client->available();
+    if (_remaining >= 0 && size > _remaining)
+    {
+        size = _remaining;
+    }
+    return size;
+}
+
+int SpotifyBodyStream::read()
+{
+    if (!prepare())
+    {
+        return -1;
+    }
+
+    char c;
+    if (_client->readBytes(&c, 1) != 1)
+    {
+        return -1;
+    }
+    consumed(1);
+    return (uint8_t)c;
+}
+
+size_t SpotifyBodyStream::readBytes(char *buffer, size_t length)
+{
+    size_t total = 0;
+    while (total < length && prepare())
+    {
+        size_t size = length - total;
+        if (_remaining >= 0 && size > (size_t)_remaining)
+        {
+            size = _remaining;
+        }
+        size_t read = _client->readBytes(buffer + total, size);
+        if (read == 0)
+        {
+            break;
+        }
+        consumed(read);
+        total += read;
+    }
+    return total;
+}
+
+int SpotifyBodyStream::peek()
+{
+    if (!prepare())
+    {
+        return -1;
+    }
+    return _client->peek();
+}
+
+long SpotifyBodyStream::drain()
+{
+    long drained = 0;
+    char buffer[32];
+    size_t read;
+    while ((read = readBytes(buffer, sizeof(buffer))) > 0)
+    {
+        drained += read;
+    }
+    return drained;
+}
+
+bool SpotifyBodyStream::prepare()
+{
+    if (_done)
+    {
+        return false;
+    }
+
+    if (_chunked && _remaining == 0 && !nextChunk())
+    {
+        _done = true;
+        return false;
+    }
+
+    if (_remaining < 0 && !_client->connected() && _client->available() == 0)
+    {
+        // No length given, the body ends when the server closes
+        _done = true;
+        return false;
+    }
+
+    return true;
+}
+
+void SpotifyBodyStream::consumed(long count)
+{
+    if (_remaining > 0)
+    {
+        _remaining -= count;
+        if (_remaining == 0 && !_chunked)
+        {
+            _done = true;
+        }
+    }
+}
+
+bool SpotifyBodyStream::nextChunk()
+{
+    char line[20];
+    size_t length = _client->readBytesUntil('\n', line, sizeof(line) - 1);
+    if (length > 0 && line[0] == '\r')
+    {
+        // The CRLF that ends the previous chunk
+        length = _client->readBytesUntil('\n', line, sizeof(line) - 1);
+    }
+    if (length == 0)
+    {
+        return false;
+    }
+    line[length] = '\0';
+
+    _remaining = strtol(line, NULL, 16);
+    if (_remaining <= 0)
+    {
+        // Last chunk, skip any trailers up to the blank line
+        while ((length = _client->readBytesUntil('\n', line, sizeof(line) - 1)) > 0 && line[0] != '\r')
+        {
+        }
+        _remaining = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void SpotifyStringBody::writeBody(Print &out)
+{
+    out.print(_body);
+}
+
+void SpotifyFormBody::add(const __FlashStringHelper *name, const char *value)
+{
+    if (_numFields < SPOTIFY_MAX_FORM_FIELDS)
+    {
+        _names[_numFields] = name;
+        _values[_numFields] = value;
+        _numFields++;
+    }
+}
+
+void SpotifyFormBody::writeBody(Print &out)
+{
+    for (int i = 0; i < _numFields; i++)
+    {
+        if (i > 0)
+        {
+            out.print('&');
+        }
+        out.print(_names[i]);
+        out.print('=');
+        out.print(_values[i]);
+    }
+}
+
+bool SpotifyPlayOptions::addTrackUri(const char *uri)
+{
+    if (numTrackUris >= SPOTIFY_MAX_PLAY_URIS)
+    {
+        return false;
+    }
+
+    trackUris[numTrackUris++] = uri;
+    return true;
+}
+
+void SpotifyPlayOptions::writeBody(Print &out)
+{
+    bool first = true;
+    out.print('{');
+    if (contextUri != NULL)
+    {
+        out.print(F("\"context_uri\":\""));
+        out.print(contextUri);
+        out.print('"');
+        first = false;
+    }
+
+    if (numTrackUris > 0)
+    {
+        if (!first)
+        {
+            out.print(',');
+        }
+        out.print(F("\"uris\":["));
+        for (int i = 0; i < numTrackUris; i++)
+        {
+            if (i > 0)
+            {
+                out.print(',');
+            }
+            out.print('"');
+            out.print(trackUris[i]);
+            out.print('"');
+        }
+        out.print(']');
+        first = false;
+    }
+
+    if (offsetUri != NULL || offsetPosition >= 0)
+    {
+        if (!first)
+        {
+            out.print(',');
+        }
+        out.print(F("\"offset\":{"));
+        if (offsetUri != NULL)
+        {
+            out.print(F("\"uri\":\""));
+            out.print(offsetUri);
+            out.print('"');
+        }
+        else
+        {
+            out.print(F("\"position\":"));
+            out.print(offsetPosition);
+        }
+        out.print('}');
+        first = false;
+    }
+
+    if (positionMs >= 0)
+    {
+        if (!first)
+        {
+            out.print(',');
+        }
+        out.print(F("\"position_ms\":"));
+        out.print(positionMs);
+    }
+    out.print('}');
+}
+
+// Body of a transfer playback request: {"device_ids":["<id>"],"play":<play>}
+class SpotifyTransferBody : public SpotifyBodyWriter
+{
+public:
+    SpotifyTransferBody(const char *deviceId, bool play) : _deviceId(deviceId), _play(play) {}
+    void writeBody(Print &out)
+    {
+        out.print(F("{\"device_ids\":[\""));
+        out.print(_deviceId);
+        out.print(F("\"],\"play\":"));
+        out.print(_play ? F("true") : F("false"));
+        out.print('}');
+    }
+
+private:
+    const char *_deviceId;
+    bool _play;
+};
+
+// Path of a getTracks/getAlbums request: the endpoint, the IDs separated by
+// commas and the market. Written straight to the client so up to 50 IDs
+// never have to be copied into one buffer on the stack.
+class SpotifyIdListPath : public SpotifyBodyWriter
+{
+public:
+    SpotifyIdListPath(const char *endpoint, SpotifyIdBatch &batch, int first, int last, const char *market)
+        : _endpoint(endpoint), _batch(batch), _first(first), _last(last), _market(market) {}
+    void writeBody(Print &out)
+    {
+        out.print(_endpoint);
+        for (int i = _first; i < _last; i++)
+        {
+            if (i > _first)
+            {
+                out.print(',');
+            }
+            out.print(_batch.ids[i]);
+        }
+        if (_market[0] != 0)
+        {
+            out.print(F("&market="));
+            out.print(_market);
+        }
+    }
+
+private:
+    const char *_endpoint;
+    SpotifyIdBatch &_batch;
+    int _first;
+    int _last;
+    const char *_market;
+};
+
+SpotifyJsonCutoff::SpotifyJsonCutoff(Stream &source, const char *const *keys, uint8_t numKeys) : _source(source)
+{
+    _keys = keys;
+    _numKeys = numKeys;
+}
+
+int SpotifyJsonCutoff::available()
+{
+    if (_peeked >= 0)
+    {
+        return 1;
+    }
+    return _done ? 0 : _source.available();
+}
+
+int SpotifyJsonCutoff::peek()
+{
+    if (_peeked < 0)
+    {
+        _peeked = next();
+    }
+    return _peeked;
+}
+
+int SpotifyJsonCutoff::read()
+{
+    int c = peek();
+    _peeked = -1;
+    return c;
+}
+
+int SpotifyJsonCutoff::next()
+{
+    if (_done)
+    {
+        if (_pending != 0)
+        {
+            int pending = _pending;
+            _pending = 0;
+            return pending;
+        }
+        return -1;
+    }
+
+    int c = readSource();
+    if (c < 0 || _inString)
+    {
+        return c;
+    }
+
+    if (c == ',' && _depth == 2 && _currentKey >= 0 && _firstOnly && _inArray)
+    {
+        // Past the only element we want
+        _seen |= (1UL << _currentKey);
+        if (_seen == (1UL << _numKeys) - 1)
+        {
+            complete = true;
+            _done = true;
+            _pending = '}';
+            return ']';
+        }
+
+        // Still need more fields, swallow the rest of the array
+        while (_depth > 1 && (c = readSource()) >= 0)
+        {
+        }
+        return (c < 0) ? -1 : ']';
+    }
+
+    if (_depth == 1 && (c == ',' || c == '}'))
+    {
+        if (_currentKey >= 0)
+        {
+            _seen |= (1UL << _currentKey);
+        }
+        _currentKey = -1;
+
+        if (c == ',' && _seen == (1UL << _numKeys) - 1)
+        {
+            // Everything we need has been read, close the root object instead
+            complete = true;
+            _done = true;
+            return '}';
+        }
+    }
+
+    return c;
+}
+
+int SpotifyJsonCutoff::readSource()
+{
+    char c;
+    if (_source.readBytes(&c, 1) != 1)
+    {
+        return -1;
+    }
+    bytesRead++;
+
+    if (_inString)
+    {
+        if (_escape)
+        {
+            _escape = false;
+        }
+        else if (c == '\\')
+        {
+            _escape = true;
+        }
+        else if (c == '"')
+        {
+            _inString = false;
+            if (_readingKey)
+            {
+                _key[_keyLength] = '\0';
+                _readingKey = false;
+            }
+        }
+        else if (_readingKey && _keyLength < sizeof(_key) - 1)
+        {
+            _key[_keyLength++] = c;
+        }
+        return (uint8_t)c;
+    }
+
+    switch (c)
+    {
+    case '"':
+        _inString = true;
+        if (_depth == 1 && _currentKey < 0 && !_inValue)
+        {
+            _readingKey = true;
+            _keyLength = 0;
+        }
+        break;
+    case ':':
+        if (_depth == 1)
+        {
+            _inValue = true;
+            _inArray = false;
+            _currentKey = matchKey();
+        }
+        break;
+    case '[':
+        if (_depth == 1)
+        {
+            _inArray = true;
+        }
+        _depth++;
+        break;
+    case '{':
+        _depth++;
+        break;
+    case ']':
+    case '}':
+        _depth--;
+        break;
+    case ',':
+        if (_depth == 1)
+        {
+            _inValue = false;
+        }
+        break;
+    }
+
+    return (uint8_t)c;
+}
+
+int8_t SpotifyJsonCutoff::matchKey()
+{
+    size_t keyLength = strlen(_key);
+    for (uint8_t i = 0; i < _numKeys; i++)
+    {
+        const char *key = _keys[i];
+        size_t length = strlen(key);
+        bool firstOnly = length > 3 && strcmp(key + length - 3, "[0]") == 0;
+        if (firstOnly)
+        {
+            length -= 3;
+        }
+
+        if (length == keyLength && strncmp(key, _key, length) == 0)
+        {
+            _firstOnly = firstOnly;
+            return i;
+        }
+    }
+
+    _firstOnly = false;
+    return -1;
+}
+
+int SpotifyArduino::makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+{
+    SpotifyStringBody stringBody(body);
+    return makeRequestWithBody(type, command, authorization, stringBody, contentType, host);
+}
+
+int SpotifyArduino::makeRequestWithBody(const char *type, const char *command, const char *authorization, SpotifyBodyWriter &body, const char *contentType, const char *host)
+{
+    resetLastError(-1);
+
+    // Dry run to get the Content-Length, so the body never has to be held in memory
+    SpotifyLengthCounter bodyLength;
+    body.writeBody(bodyLength);
+
+    if (!linkAvailable())
+    {
+        return -1;
+    }
+
+    armDeadlines(type, command, host);
+    client->flush();
+    SPOTIFY_LOG_DEBUG("Host: ", host);
+    client->setTimeout(SPOTIFY_TIMEOUT);
+    if (!client->connect(host, portNumber))
+    {
+        connectFailed();
+        return -1;
+    }
+
+    // give the esp a breather
+    yield();
+
+    // Send HTTP request
+    client->print(type);
+    client->print(command);
+    client->println(F(" HTTP/1.0"));
+
+    //Headers
+    client->print(F("Host: "));
+    client->println(host);
+
+    client->println(F("Accept: application/json"));
+    client->print(F("Content-Type: "));
+    client->println(contentType);
+
+    if (authorization != NULL)
+    {
+        client->print(F("Authorization: "));
+        client->println(authorization);
+    }
+
+    client->println(F("Cache-Control: no-cache"));
+
+    client->print(F("Content-Length: "));
+    client->println(bodyLength.length);
+
+    client->println();
+
+    body.writeBody(*client);
+
+    if (client->println() == 0)
+    {
+        SPOTIFY_LOG_ERROR("Failed to send request");
+        connectFailed();
+        _lastError.statusCode = -2;
+        return -2;
+    }
+
+    int statusCode = getHttpStatusCode();
+    if (statusCode > 0 && journal != NULL)
+    {
+        journal->linkWorked();
+    }
+
+    _lastError.statusCode = statusCode;
+    if (statusCode >= 400)
+    {
+        readError(host);
+        if (refreshForRetry(statusCode, authorization))
+        {
+            _retrying = true;
+            statusCode = makeRequestWithBody(type, command, authorization, body, contentType, host);
+            _retrying = false;
+        }
+    }
+    return statusCode;
+}
+
+int SpotifyArduino::makePutRequest(const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+{
+    return makeRequestWithBody("PUT ", command, authorization, body, contentType, host);
+}
+
+int SpotifyArduino::makePutRequest(const char *command, const char *authorization, SpotifyBodyWriter &body, const char *contentType, const char *host)
+{
+    return makeRequestWithBody("PUT ", command, authorization, body, contentType, host);
+}
+
+int SpotifyArduino::makePostRequest(const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+{
+    return makeRequestWithBody("POST ", command, authorization, body, contentType, host);
+}
+
+int SpotifyArduino::makePostRequest(const char *command, const char *authorization, SpotifyBodyWriter &body, const char *contentType, const char *host)
+{
+    return makeRequestWithBody("POST ", command, authorization, body, contentType, host);
+}
+
+int SpotifyArduino::makeGetRequest(const char *command, const char *authorization, const char *accept, const char *host, long rangeStart)
+{
+    SpotifyStringBody path(command);
+    return sendGetRequest(command, path, authorization, accept, host, rangeStart);
+}
+
+int SpotifyArduino::sendGetRequest(const char *command, SpotifyBodyWriter &path, const char *authorization, const char *accept, const char *host, long rangeStart)
+{
+    // command is only used to pick the deadlines, the request line comes from path
+    resetLastError(-1);
+
+    if (!linkAvailable())
+    {
+        return -1;
+    }
+
+    armDeadlines("GET", command, host);
+    client->flush();
+    client->setTimeout(SPOTIFY_TIMEOUT);
+    if (!client->connect(host, portNumber))
+    {
+        connectFailed();
+        return -1;
+    }
+
+    // give the esp a breather
+    yield();
+
+    // Send HTTP request
+    client->print(F("GET "));
+    path.writeBody(*client);
+    client->println(F(" HTTP/1.0"));
+
+    //Headers
+    client->print(F("Host: "));
+    client->println(host);
+
+    if (accept != NULL)
+    {
+        client->print(F("Accept: "));
+        client->println(accept);
+    }
+
+    if (authorization != NULL)
+    {
+        client->print(F("Authorization: "));
+        client->println(authorization);
+    }
+
+    if (rangeStart > 0)
+    {
+        client->print(F("Range: bytes="));
+        client->print(rangeStart);
+        client->println('-');
+    }
+    else if (_inflater != NULL && strcmp(host, SPOTIFY_HOST) == 0)
+    {
+        // Only the API's JSON compresses well, images are already compressed
+        client->println(F("Accept-Encoding: gzip"));
+    }
+
+    client->println(F("Cache-Control: no-cache"));
+
+    if (client->println() == 0)
+    {
+        SPOTIFY_LOG_ERROR("Failed to send request");
+        connectFailed();
+        _lastError.statusCode = -2;
+        return -2;
+    }
+
+    int statusCode = getHttpStatusCode();
+    if (statusCode > 0 && journal != NULL)
+    {
+        journal->linkWorked();
+    }
+
+    _lastError.statusCode = statusCode;
+    if (statusCode >= 400)
+    {
+        readError(host);
+        if (refreshForRetry(statusCode, authorization))
+        {
+            _retrying = true;
+            statusCode = sendGetRequest(command, path, authorization, accept, host, rangeStart);
+            _retrying = false;
+        }
+    }
+
+    return statusCode;
+}
+
+void SpotifyArduino::setRefreshToken(const char *refreshToken)
+{
+    int newRefreshTokenLen = strlen(refreshToken);
+    if (_refreshToken == NULL || strlen(_refreshToken) < newRefreshTokenLen)
+    {
+        delete _refreshToken;
+        _refreshToken = new char[newRefreshTokenLen + 1]();
+    }
+
+    strncpy(_refreshToken, refreshToken, newRefreshTokenLen + 1);
+}
+
+bool SpotifyArduino::refreshAccessToken()
+{
+    SpotifyFormBody body;
+    body.add(F("grant_type"), "refresh_token");
+    body.add(F("refresh_token"), _refreshToken);
+    body.add(F("client_id"), _clientId);
+    body.add(F("client_secret"), _clientSecret);
+
+    SPOTIFY_LOG_BODY(body);
+    SPOTIFY_LOG_STACK();
+
+    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
+    if (statusCode > 0)
+    {
+        skipHeaders();
+    }
+    unsigned long now = millis();
+
+    SPOTIFY_LOG_DEBUG("status Code", statusCode);
+
+    bool refreshed = false;
+    if (statusCode == 200)
+    {
+        StaticJsonDocument<48> filter;
+        filter["access_token"] = true;
+        filter["token_type"] = true;
+        filter["expires_in"] = true;
+
+        SpotifyJsonDocument doc(SPOTIFY_TOKEN_DOC_SIZE, &_jsonArena);
+
+        // Parse JSON object
+        DeserializationError error = deserializeResponse(doc, *client, filter, tokenKeys, sizeof(tokenKeys) / sizeof(tokenKeys[0]));
+        if (!error)
+        {
+            SPOTIFY_LOG_DEBUG("No JSON error, dealing with response");
+            const char *accessToken = doc["access_token"].as<const char *>();
+            if (accessToken != NULL && (SPOTIFY_ACCESS_TOKEN_LENGTH >= strlen(accessToken)))
+            {
+                sprintf(this->_bearerToken, "Bearer %s", accessToken);
+                int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
+                tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
+                timeTokenRefreshed = now;
+                refreshed = true;
+            }
+            else
+            {
+                SPOTIFY_LOG_ERROR("Problem with access_token (too long or null): ", accessToken);
+            }
+        }
+        else
+        {
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+        }
+    }
+
+    closeClient();
+    return refreshed;
+}
+
+bool SpotifyArduino::checkAndRefreshAccessToken()
+{
+    unsigned long timeSinceLastRefresh = millis() - timeTokenRefreshed;
+    if (timeSinceLastRefresh >= tokenTimeToLiveMs)
+    {
+        SPOTIFY_LOG_INFO("Refresh of the Access token is due, doing that now.");
+        return refreshAccessToken();
+    }
+
+    // Token is still valid
+    return true;
+}
+
+const char *SpotifyArduino::requestAccessTokens(const char *code, const char *redirectUrl)
+{
+    SpotifyFormBody body;
+    body.add(F("grant_type"), "authorization_code");
+    body.add(F("code"), code);
+    body.add(F("redirect_uri"), redirectUrl);
+    body.add(F("client_id"), _clientId);
+    body.add(F("client_secret"), _clientSecret);
+
+    SPOTIFY_LOG_BODY(body);
+
+    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
+    if (statusCode > 0)
+    {
+        skipHeaders();
+    }
+    unsigned long now = millis();
+
+    SPOTIFY_LOG_DEBUG("status Code", statusCode);
+
+    if (statusCode == 200)
+    {
+        StaticJsonDocument<64> filter;
+        filter["access_token"] = true;
+        filter["refresh_token"] = true;
+        filter["expires_in"] = true;
+
+        SpotifyJsonDocument doc(SPOTIFY_TOKEN_DOC_SIZE, &_jsonArena);
+
+        // Parse JSON object
+        DeserializationError error = deserializeResponse(doc, *client, filter, authorizationKeys, sizeof(authorizationKeys) / sizeof(authorizationKeys[0]));
+        if (!error)
+        {
+            sprintf(this->_bearerToken, "Bearer %s", doc["access_token"].as<const char *>());
+            setRefreshToken(doc["refresh_token"].as<const char *>());
+            int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
+            tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
+            timeTokenRefreshed = now;
+        }
+        else
+        {
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+        }
+    }
+
+    closeClient();
+    return _refreshToken;
+}
+
+bool SpotifyArduino::play(const char *deviceId)
+{
+    return sendPlayerCommand(player_play, true, deviceId);
+}
+
+bool SpotifyArduino::playAdvanced(char *body, const char *deviceId)
+{
+    char command[100] = SPOTIFY_PLAY_ENDPOINT;
+    if (!playerControl(command, deviceId, body))
+    {
+        return false;
+    }
+
+    _playerState.isPlaying = true;
+    setPending(player_state_playing);
+    return true;
+}
+
+bool SpotifyArduino::playAdvanced(SpotifyPlayOptions &options, const char *deviceId)
+{
+    char command[100] = SPOTIFY_PLAY_ENDPOINT;
+    if (!playerControl(command, deviceId, options))
+    {
+        return false;
+    }
+
+    _playerState.isPlaying = true;
+    setPending(player_state_playing);
+    return true;
+}
+
+bool SpotifyArduino::pause(const char *deviceId)
+{
+    return sendPlayerCommand(player_pause, false, deviceId);
+}
+
+bool SpotifyArduino::setVolume(int volume, const char *deviceId)
+{
+    return sendPlayerCommand(player_volume, volume, deviceId);
+}
+
+bool SpotifyArduino::toggleShuffle(bool shuffle, const char *deviceId)
+{
+    return sendPlayerCommand(player_shuffle, shuffle, deviceId);
+}
+
+bool SpotifyArduino::setRepeatMode(RepeatOptions repeat, const char *deviceId)
+{
+    return sendPlayerCommand(player_repeat, repeat, deviceId);
+}
+
+void SpotifyArduino::setPending(SpotifyPlayerStateField field)
+{
+    _pendingSince[field] = millis();
+    _pendingFields |= (1 << field);
+    _playerState.known = true;
+}
+
+// Returns true if the local value should win over the polled one
+bool SpotifyArduino::checkPending(SpotifyPlayerStateField field, bool pollAgrees)
+{
+    if (!(_pendingFields & (1 << field)))
+    {
+        return false;
+    }
+
+    if (pollAgrees || millis() - _pendingSince[field] >= confirmationWindowMs)
+    {
+        // Confirmed, or the window is over and the server has the final say
+        _pendingFields &= ~(1 << field);
+        return false;
+    }
+
+    return true;
+}
+
+void SpotifyArduino::reconcilePlayerState(PlayerDetails &playerDetails)
+{
+    if (checkPending(player_state_playing, playerDetails.isPlaying == _playerState.isPlaying))
+    {
+        playerDetails.isPlaying = _playerState.isPlaying;
+    }
+    else
+    {
+        _playerState.isPlaying = playerDetails.isPlaying;
+    }
+
+    if (checkPending(player_state_volume, playerDetails.device.volumePercent == _playerState.volumePercent))
+    {
+        playerDetails.device.volumePercent = _playerState.volumePercent;
+    }
+    else
+    {
+        _playerState.volumePercent = playerDetails.device.volumePercent;
+    }
+
+    if (checkPending(player_state_shuffle, playerDetails.shuffleState == _playerState.shuffleState))
+    {
+        playerDetails.shuffleState = _playerState.shuffleState;
+    }
+    else
+    {
+        _playerState.shuffleState = playerDetails.shuffleState;
+    }
+
+    if (checkPending(player_state_repeat, playerDetails.repeateState == _playerState.repeatState))
+    {
+        playerDetails.repeateState = _playerState.repeatState;
+    }
+    else
+    {
+        _playerState.repeatState = playerDetails.repeateState;
+    }
+
+    _playerState.known = true;
+}
+
+void SpotifyArduino::reconcilePlayerState(CurrentlyPlaying &current)
+{
+    if (checkPending(player_state_playing, current.isPlaying == _playerState.isPlaying))
+    {
+        current.isPlaying = _playerState.isPlaying;
+    }
+    else
+    {
+        _playerState.isPlaying = current.isPlaying;
+    }
+}
+
+bool SpotifyArduino::playerControl(char *command, const char *deviceId, const char *body)
+{
+    SpotifyStringBody stringBody(body);
+    return playerControl(command, deviceId, stringBody);
+}
+
+bool SpotifyArduino::playerControl(char *command, const char *deviceId, SpotifyBodyWriter &body)
+{
+    return playerRequest("PUT ", command, deviceId, body);
+}
+
+bool SpotifyArduino::sendPlayerCommand(SpotifyPlayerCommand type, long value, const char *deviceId)
+{
+    SpotifyCommandDescriptor descriptor;
+    memcpy_P(&descriptor, &playerCommands[type], sizeof(descriptor));
+
+    char command[128];
+    strcpy(command, descriptor.path);
+    if (descriptor.query[0] != 0)
+    {
+        char number[12];
+        const char *text = number;
+        switch (descriptor.valueType)
+        {
+        case value_bool:
+            text = value ? "true" : "false";
+            break;
+        case value_repeat:
+            text = repeatStates[value];
+            break;
+        default:
+            sprintf(number, "%ld", value);
+            break;
+        }
+        sprintf(command + strlen(command), "?%s=%s", descriptor.query, text);
+    }
+
+    SpotifyStringBody noBody("");
+    if (!playerRequest(descriptor.method, command, deviceId, noBody))
+    {
+        journalCommand(descriptor.journalCommand, value, deviceId);
+        return false;
+    }
+
+    // Show the change straight away, without waiting for the next poll
+    switch (descriptor.stateField)
+    {
+    case player_state_playing:
+        _playerState.isPlaying = value != 0;
+        break;
+    case player_state_volume:
+        _playerState.volumePercent = value;
+        break;
+    case player_state_shuffle:
+        _playerState.shuffleState = value != 0;
+        break;
+    case player_state_repeat:
+        _playerState.repeatState = (RepeatOptions)value;
+        break;
+    default:
+        return true;
+    }
+    setPending((SpotifyPlayerStateField)descriptor.stateField);
+    return true;
+}
+
+bool SpotifyArduino::playerRequest(const char *type, const char *command, const char *deviceId, SpotifyBodyWriter &body, bool allowFallback)
+{
+    // Built here rather than in the caller's buffer, so a retry on the
+    // fallback device starts again from the plain command
+    char url[100 + SPOTIFY_DEVICE_ID_CHAR_LENGTH + 12];
+    if (deviceId[0] != 0)
+    {
+        // After any parameters the command already has
+        snprintf(url, sizeof(url), "%s%cdevice_id=%s", command, strchr(command, '?') == NULL ? '?' : '&', deviceId);
+    }
+    else
+    {
+        snprintf(url, sizeof(url), "%s", command);
+    }
+
+    SPOTIFY_LOG_DEBUG("Request: ", url);
+    SPOTIFY_LOG_BODY(body);
+    SPOTIFY_LOG_STACK();
+
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
+    int statusCode = makeRequestWithBody(type, url, _bearerToken, body);
+
+    closeClient();
+
+    const char *fallbackId = allowFallback ? transferToFallback(statusCode, deviceId) : NULL;
+    if (fallbackId != NULL)
+    {
+        return playerRequest(type, command, fallbackId, body, false);
+    }
+
+    //Will return 204 if all went well.
+    return statusCode == 204;
+}
+
+bool SpotifyArduino::playerNavigate(char *command, const char *deviceId)
+{
+    SpotifyStringBody noBody("");
+    return playerRequest("POST ", command, deviceId, noBody);
+}
+
+bool SpotifyArduino::nextTrack(const char *deviceId)
+{
+    return sendPlayerCommand(player_next, 0, deviceId);
+}
+
+bool SpotifyArduino::previousTrack(const char *deviceId)
+{
+    return sendPlayerCommand(player_previous, 0, deviceId);
+}
+bool SpotifyArduino::seek(int position, const char *deviceId)
+{
+    return sendPlayerCommand(player_seek, position, deviceId);
+}
+
+bool SpotifyArduino::transferPlayback(const char *deviceId, bool play)
+{
+    SpotifyTransferBody body(deviceId, play);
+
+    // The device goes in the body rather than the query. A transfer is
+    // never retried on the fallback device, it is how the fallback happens
+    if (!playerRequest("PUT ", SPOTIFY_PLAYER_ENDPOINT, "", body, false))
+    {
+        journalCommand(journal_transfer, play, deviceId);
+        return false;
+    }
+
+    for (int i = 0; i < _numDevices; i++)
+    {
+        _devices[i].isActive = strcmp(_devices[i].id, deviceId) == 0;
+    }
+    return true;
+}
+
+void SpotifyArduino::setMarket(const char *market)
+{
+    strncpy(_market, market, sizeof(_market) - 1);
+    _market[sizeof(_market) - 1] = '\0';
+}
+
+const char *SpotifyArduino::getMarket()
+{
+    if (_market[0] == 0)
+    {
+        resolveMarket();
+    }
+
+    // If the lookup couldn't even be made, let Spotify work it out from the token this time
+    return (_market[0] != 0) ? _market : SPOTIFY_MARKET_FROM_TOKEN;
+}
+
+int SpotifyArduino::resolveMarket()
+{
+    int statusCode = startGetRequest(SPOTIFY_USER_ENDPOINT);
+
+    if (statusCode == 200)
+    {
+        StaticJsonDocument<16> filter;
+        filter["country"] = true;
+
+        StaticJsonDocument<96> doc;
+        DeserializationError error = deserializeResponse(doc, responseBody(), filter, userKeys, sizeof(userKeys) / sizeof(userKeys[0]));
+        if (!error && !doc["country"].isNull())
+        {
+            setMarket(doc["country"].as<const char *>());
+        }
+        else
+        {
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+        }
+    }
+
+    if (statusCode > 0 && _market[0] == 0)
+    {
+        // Without the user-read-private scope there is no country, from_token means the same thing to Spotify
+        setMarket(SPOTIFY_MARKET_FROM_TOKEN);
+    }
+
+    SPOTIFY_LOG_INFO("Market: ", _market);
+    closeClient();
+    return statusCode;
+}
+
+const char *SpotifyArduino::marketFor(const char *market)
+{
+    if (market[0] == 0 && autoMarket)
+    {
+        return getMarket();
+    }
+    return market;
+}
+
+void SpotifyArduino::appendMarket(char *command, const char *market)
+{
+    market = marketFor(market);
+    if (market[0] != 0)
+    {
+        strcat(command, (strchr(command, '?') != NULL) ? "&market=" : "?market=");
+        strcat(command, market);
+    }
+}
+
+int SpotifyArduino::startGetRequest(const char *command)
+{
+    SpotifyStringBody path(command);
+    return startGetRequest(command, path);
+}
+
+int SpotifyArduino::startGetRequest(const char *command, SpotifyBodyWriter &path)
+{
+    SPOTIFY_LOG_DEBUG("Request: ", command);
+    SPOTIFY_LOG_STACK();
+
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
+
+    int statusCode = sendGetRequest(command, path, _bearerToken, "application/json", SPOTIFY_HOST, 0);
+    SPOTIFY_LOG_DEBUG("Status Code: ", statusCode);
+    if (statusCode > 0)
+    {
+        skipHeaders();
+    }
+    return statusCode;
+}
+
+int SpotifyArduino::getCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market)
+{
+    char command[100] = SPOTIFY_CURRENTLY_PLAYING_ENDPOINT;
+    appendMarket(command, market);
+
+    int statusCode = startGetRequest(command);
+    if (statusCode == 200 && !parseCurrentlyPlaying(responseBody(), currentlyPlayingCallback))
+    {
+        statusCode = -1;
+    }
+
+    closeClient();
+    return statusCode;
+}
+
+int SpotifyArduino::getPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market)
+{
+    char command[100] = SPOTIFY_PLAYER_ENDPOINT;
+    appendMarket(command, market);
+
+    int statusCode = startGetRequest(command);
+    if (statusCode == 200 && !parsePlayerDetails(responseBody(), playerDetailsCallback))
+    {
+        statusCode = -1;
+    }
+
+    closeClient();
+    return statusCode;
+}
+
+int SpotifyArduino::getPlayerState(processPlayerDetails playerDetailsCallback, processCurrentlyPlaying currentlyPlayingCallback, const char *market)
+{
+    char command[100] = SPOTIFY_PLAYER_STATE_ENDPOINT;
+    appendMarket(command, market);
+
+    // Get from https://arduinojson.org/v6/assistant/
+    const size_t bufferSize = currentlyPlayingBufferSize;
+
+    int statusCode = startGetRequest(command);
+    if (statusCode == 200)
+    {
+        // The player endpoint returns the same "item" as currently-playing,
+        // so both filters can be merged and parsed in one go
+        StaticJsonDocument<656> filter;
+        addCurrentlyPlayingFilter(filter);
+        addPlayerDetailsFilter(filter);
+
+        // Allocate the document, from the arena if there is one
+        SpotifyJsonDocument doc(bufferSize, &_jsonArena);
+
+        // Parse JSON object
+        DeserializationError error = deserializeResponse(doc, responseBody(), filter, playerStateKeys, sizeof(playerStateKeys) / sizeof(playerStateKeys[0]));
+        if (!error)
+        {
+            SPOTIFY_LOG_JSON(doc);
+            PlayerDetails playerDetails;
+            fillPlayerDetails(doc, playerDetails);
+            reconcilePlayerState(playerDetails);
+            if (statePublisher != NULL)
+            {
+                statePublisher->update(playerDetails);
+            }
+            if (playerDetailsCallback != NULL)
+            {
+                playerDetailsCallback(playerDetails);
+            }
+
+            if (currentlyPlayingCallback != NULL || statePublisher != NULL)
+            {
+                CurrentlyPlaying current;
+                fillCurrentlyPlaying(doc, current);
+                reconcilePlayerState(current);
+                if (statePublisher != NULL)
+                {
+                    statePublisher->update(current);
+                }
+                if (currentlyPlayingCallback != NULL)
+                {
+                    currentlyPlayingCallback(current);
+                }
+            }
+        }
+        else
+        {
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+            statusCode = -1;
+        }
+    }
+
+    closeClient();
+    return statusCode;
+}
+
+void SpotifyArduino::addCurrentlyPlayingFilter(JsonDocument &filter)
+{
+    filter["is_playing"] = true;
+    filter["currently_playing_type"] = true;
+    filter["progress_ms"] = true;
+    filter["context"]["uri"] = true;
+
+    JsonObject filter_item = filter.createNestedObject("item");
+    filter_item["duration_ms"] = true;
+    filter_item["name"] = true;
+    filter_item["uri"] = true;
+
+    JsonObject filter_item_artists_0 = filter_item["artists"].createNestedObject();
+    filter_item_artists_0["name"] = true;
+    filter_item_artists_0["uri"] = true;
+
+    JsonObject filter_item_album = filter_item.createNestedObject("album");
+    filter_item_album["name"] = true;
+    filter_item_album["uri"] = true;
+
+    JsonObject filter_item_album_images_0 = filter_item_album["images"].createNestedObject();
+    filter_item_album_images_0["height"] = true;
+    filter_item_album_images_0["width"] = true;
+    filter_item_album_images_0["url"] = true;
+
+    // Podcast filters
+    JsonObject filter_item_show = filter_item.createNestedObject("show");
+    filter_item_show["name"] = true;
+    filter_item_show["uri"] = true;
+
+    JsonObject filter_item_images_0 = filter_item["images"].createNestedObject();
+    filter_item_images_0["height"] = true;
+    filter_item_images_0["width"] = true;
+    filter_item_images_0["url"] = true;
+}
+
+void SpotifyArduino::addPlayerDetailsFilter(JsonDocument &filter)
+{
+    JsonObject filter_device = filter.createNestedObject("device");
+    filter_device["id"] = true;
+    filter_device["name"] = true;
+    filter_device["type"] = true;
+    filter_device["is_active"] = true;
+    filter_device["is_private_session"] = true;
+    filter_device["is_restricted"] = true;
+    filter_device["volume_percent"] = true;
+    filter["progress_ms"] = true;
+    filter["is_playing"] = true;
+    filter["shuffle_state"] = true;
+    filter["repeat_state"] = true;
+}
+
+void SpotifyArduino::fillCurrentlyPlaying(JsonDocument &doc, CurrentlyPlaying &current)
+{
+    JsonObject item = doc["item"];
+
+    const char *currently_playing_type = doc["currently_playing_type"];
+
+    current.isPlaying = doc["is_playing"].as<bool>();
+
+    current.progressMs = doc["progress_ms"].as<long>();
+    current.durationMs = item["duration_ms"].as<long>();
+
+    // Only a track or an episode fills these in, not e.g. an ad
+    current.trackName = NULL;
+    current.trackUri = NULL;
+    current.albumName = NULL;
+    current.albumUri = NULL;
+    current.numArtists = 0;
+    current.numImages = 0;
+
+    // context may be null
+    if (!doc["context"].isNull())
+    {
+        current.contextUri = doc["context"]["uri"].as<const char *>();
+    }
+    else
+    {
+        current.contextUri = NULL;
+    }
+
+    // Check currently playing type
+    if (currently_playing_type != NULL && strcmp(currently_playing_type, "track") == 0)
+    {
+        current.currentlyPlayingType = track;
+    }
+    else if (currently_playing_type != NULL && strcmp(currently_playing_type, "episode") == 0)
+    {
+        current.currentlyPlayingType = episode;
+    }
+    else
+    {
+        current.currentlyPlayingType = other;
+    }
+
+    // If it's a song/track
+    if (current.currentlyPlayingType == track)
+    {
+        int numArtists = item["artists"].size();
+        if (numArtists > SPOTIFY_MAX_NUM_ARTISTS)
+        {
+            numArtists = SPOTIFY_MAX_NUM_ARTISTS;
+        }
+        current.numArtists = numArtists;
+
+        for (int i = 0; i < current.numArtists; i++)
+        {
+            current.artists[i].artistName = item["artists"][i]["name"].as<const char *>();
+            current.artists[i].artistUri = item["artists"][i]["uri"].as<const char *>();
+        }
+
+        current.albumName = item["album"]["name"].as<const char *>();
+        current.albumUri = item["album"]["uri"].as<const char *>();
+
+        JsonArray images = item["album"]["images"];
+
+        // Images are returned in order of width, so last should be smallest.
+        int numImages = images.size();
+        int startingIndex = 0;
+        if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
+        {
+            startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+            current.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+        }
+        else
+        {
+            current.numImages = numImages;
+        }
+        SPOTIFY_LOG_DEBUG("Num Images: ", numImages);
+
+        for (int i = 0; i < current.numImages; i++)
+        {
+            int adjustedIndex = startingIndex + i;
+            current.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
+            current.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
+            current.albumImages[i].url = images[adjustedIndex]["url"].as<const char *>();
+        }
+
+        current.trackName = item["name"].as<const char *>();
+        current.trackUri = item["uri"].as<const char *>();
+    }
+    else if (current.currentlyPlayingType == episode) // Podcast
+    {
+        current.numArtists = 1;
+
+        // Save Podcast as the "track"
+        current.trackName = item["name"].as<const char *>();
+        current.trackUri = item["uri"].as<const char *>();
+
+        // Save Show name as the "artist"
+        current.artists[0].artistName = item["show"]["name"].as<const char *>();
+        current.artists[0].artistUri = item["show"]["uri"].as<const char *>();
+
+        // Leave "album" name blank
+        current.albumName = "";
+        current.albumUri = "";
+
+        // Save the episode images as the "album art"
+        JsonArray images = item["images"];
+        // Images are returned in order of width, so last should be smallest.
+        int numImages = images.size();
+        int startingIndex = 0;
+        if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
+        {
+            startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+            current.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+        }
+        else
+        {
+            current.numImages = numImages;
+        }
+        SPOTIFY_LOG_DEBUG("Num Images: ", numImages);
+
+        for (int i = 0; i < current.numImages; i++)
+        {
+            int adjustedIndex = startingIndex + i;
+            current.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
+            current.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
+            current.albumImages[i].url = images[adjustedIndex]["url"].as<const char *>();
+        }
+    }
+
+    current.prefetchedImage = NULL;
+    current.prefetchedImageLength = 0;
+    if (_prefetch.imageLength > 0 && current.trackUri != NULL && strcmp(current.trackUri, _prefetch.trackUri) == 0)
+    {
+        SPOTIFY_LOG_DEBUG("Using prefetched album art");
+        current.prefetchedImage = _prefetch.image;
+        current.prefetchedImageLength = _prefetch.imageLength;
+    }
+}
+
+void SpotifyArduino::fillPlayerDetails(JsonDocument &doc, PlayerDetails &playerDetails)
+{
+    JsonObject device = doc["device"];
+    playerDetails.device.id = device["id"].as<const char *>();
+    playerDetails.device.name = device["name"].as<const char *>();
+    playerDetails.device.type = device["type"].as<const char *>();
+
+    playerDetails.device.isActive = device["is_active"].as<bool>();
+    playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
+    playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
+    playerDetails.device.volumePercent = device["volume_percent"].as<int>();
+
+    playerDetails.progressMs = doc["progress_ms"].as<long>();
+    playerDetails.isPlaying = doc["is_playing"].as<bool>();
+
+    playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
+
+    const char *repeat_state = doc["repeat_state"];
+
+    if (repeat_state != NULL && strncmp(repeat_state, "track", 5) == 0)
+    {
+        playerDetails.repeateState = repeat_track;
+    }
+    else if (repeat_state != NULL && strncmp(repeat_state, "context", 7) == 0)
+    {
+        playerDetails.repeateState = repeat_context;
+    }
+    else
+    {
+        playerDetails.repeateState = repeat_off;
+    }
+}
+
+void SpotifyArduino::checkDocumentSize(DeserializationError error, JsonDocument &doc)
+{
+    if (error == DeserializationError::NoMemory)
+    {
+        stats.documentsTooSmall++;
+        SPOTIFY_LOG_ERROR("Response did not fit in a document of ", (long)doc.capacity());
+    }
+}
+
+DeserializationError SpotifyArduino::deserializeResponse(JsonDocument &doc, Stream &body, JsonDocument &filter, const char *const *keys, uint8_t numKeys)
+{
+    SpotifyJsonCutoff cutoff(body, keys, numKeys);
+
+    // Parse JSON object
+#ifndef SPOTIFY_PRINT_JSON_PARSE
+    DeserializationError error = deserializeJson(doc, cutoff, DeserializationOption::Filter(filter));
+#else
+    ReadLoggingStream loggingStream(cutoff, Serial);
+    DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
+#endif
+
+    if (!error && _deadlineClient.end != request_completed)
+    {
+        // The parser may have closed what it had, it's still not the whole response
+        error = DeserializationError::IncompleteInput;
+    }
+    checkDocumentSize(error, doc);
+
+    stats.responsesParsed++;
+    stats.lastBodyBytesParsed = cutoff.bytesRead;
+    stats.bodyBytesParsed += cutoff.bytesRead;
+    stats.lastBodyBytesUnread = 0;
+
+    // A gzip body's Content-Length is before inflating, so its full size isn't known
+    long bodyLength = _gzipped ? -1 : _contentLength;
+    stats.lastBodySize = (bodyLength >= 0) ? bodyLength : (long)cutoff.bytesRead;
+    if (cutoff.complete && bodyLength > (long)cutoff.bytesRead)
+    {
+        stats.lastBodyBytesUnread = bodyLength - cutoff.bytesRead;
+        stats.bodyBytesUnread += stats.lastBodyBytesUnread;
+        SPOTIFY_LOG_DEBUG("Stopped reading early, bytes not read: ", stats.lastBodyBytesUnread);
+    }
+
+    return error;
+}
+
+bool SpotifyArduino::parseCurrentlyPlaying(Stream &body, processCurrentlyPlaying currentlyPlayingCallback)
+{
+    //Apply Json Filter: https://arduinojson.org/v6/example/filter/
+    StaticJsonDocument<464> filter;
+    addCurrentlyPlayingFilter(filter);
+
+    // Get from https://arduinojson.org/v6/assistant/
+    SpotifyJsonDocument doc(currentlyPlayingBufferSize, &_jsonArena);
+
+    // Parse JSON object
+    DeserializationError error = deserializeResponse(doc, body, filter, currentlyPlayingKeys, sizeof(currentlyPlayingKeys) / sizeof(currentlyPlayingKeys[0]));
+    if (error)
+    {
+        SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+        return false;
+    }
+
+    SPOTIFY_LOG_JSON(doc);
+    CurrentlyPlaying current;
+    fillCurrentlyPlaying(doc, current);
+    reconcilePlayerState(current);
+    if (statePublisher != NULL)
+    {
+        statePublisher->update(current);
+    }
+    if (currentlyPlayingCallback != NULL)
+    {
+        currentlyPlayingCallback(current);
+    }
+    return true;
+}
+
+bool SpotifyArduino::parsePlayerDetails(Stream &body, processPlayerDetails playerDetailsCallback)
+{
+    StaticJsonDocument<192> filter;
+    addPlayerDetailsFilter(filter);
+
+    // Get from https://arduinojson.org/v6/assistant/
+    SpotifyJsonDocument doc(playerDetailsBufferSize, &_jsonArena);
+
+    // Parse JSON object
+    DeserializationError error = deserializeResponse(doc, body, filter, playerDetailsKeys, sizeof(playerDetailsKeys) / sizeof(playerDetailsKeys[0]));
+    if (error)
+    {
+        SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+        return false;
+    }
+
+    PlayerDetails playerDetails;
+    fillPlayerDetails(doc, playerDetails);
+    reconcilePlayerState(playerDetails);
+    if (statePublisher != NULL)
+    {
+        statePublisher->update(playerDetails);
+    }
+    if (playerDetailsCallback != NULL)
+    {
+        playerDetailsCallback(playerDetails);
+    }
+    return true;
+}
+
+bool SpotifyArduino::parseDevices(Stream &body, processDevices devicesCallback)
+{
+    StaticJsonDocument<192> filter;
+    JsonObject filter_device = filter["devices"].createNestedObject();
+    filter_device["id"] = true;
+    filter_device["name"] = true;
+    filter_device["type"] = true;
+    filter_device["is_active"] = true;
+    filter_device["is_private_session"] = true;
+    filter_device["is_restricted"] = true;
+    filter_device["volume_percent"] = true;
+
+    // Get from https://arduinojson.org/v6/assistant/
+    SpotifyJsonDocument doc(getDevicesBufferSize, &_jsonArena);
+
+    // Parse JSON object
+    DeserializationError error = deserializeResponse(doc, body, filter, devicesKeys, sizeof(devicesKeys) / sizeof(devicesKeys[0]));
+    if (error)
+    {
+        SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+        return false;
+    }
+
+    uint8_t totalDevices = doc["devices"].size();
+
+    _numDevices = 0;
+    _devicesFetchedAt = millis();
+    if (_devicesFetchedAt == 0)
+    {
+        // 0 means never fetched
+        _devicesFetchedAt = 1;
+    }
+
+    SpotifyDevice spotifyDevice;
+    bool wantsMore = devicesCallback != NULL;
+    for (int i = 0; i < totalDevices; i++)
+    {
+        JsonObject device = doc["devices"][i];
+        spotifyDevice.id = device["id"].as<const char *>();
+        spotifyDevice.name = device["name"].as<const char *>();
+        spotifyDevice.type = device["type"].as<const char *>();
+
+        spotifyDevice.isActive = device["is_active"].as<bool>();
+        spotifyDevice.isPrivateSession = device["is_private_session"].as<bool>();
+        spotifyDevice.isRestricted = device["is_restricted"].as<bool>();
+        spotifyDevice.volumePercent = device["volume_percent"].as<int>();
+
+        // Restricted devices turn down Web API commands even when they have an
+        // id, so aren't worth caching. The id check only guards the copy.
+        if (_numDevices < SPOTIFY_MAX_CACHED_DEVICES && !spotifyDevice.isRestricted && spotifyDevice.id != NULL)
+        {
+            SpotifyCachedDevice *cached = &_devices[_numDevices++];
+            strncpy(cached->id, spotifyDevice.id, sizeof(cached->id) - 1);
+            cached->id[sizeof(cached->id) - 1] = '\0';
+            strncpy(cached->name, spotifyDevice.name != NULL ? spotifyDevice.name : "", sizeof(cached->name) - 1);
+            cached->name[sizeof(cached->name) - 1] = '\0';
+            strncpy(cached->type, spotifyDevice.type != NULL ? spotifyDevice.type : "", sizeof(cached->type) - 1);
+            cached->type[sizeof(cached->type) - 1] = '\0';
+            cached->isActive = spotifyDevice.isActive;
+            cached->isPrivateSession = spotifyDevice.isPrivateSession;
+            cached->isRestricted = spotifyDevice.isRestricted;
+            cached->volumePercent = spotifyDevice.volumePercent;
+        }
+
+        if (wantsMore && !devicesCallback(spotifyDevice, i, totalDevices))
+        {
+            //User has indicated they are finished, keep filling the cache though.
+            wantsMore = false;
+        }
+    }
+
+    return true;
+}
+
+bool SpotifyArduino::checkDeviceCache()
 {
-    char command[100] = SPOTIFY_PREVIOUS_TRACK_ENDPOINT;
-    return playerNavigate(command, deviceId);
+    if (_devicesFetchedAt != 0 && millis() - _devicesFetchedAt < deviceCacheTtlMs)
+    {
+        return true;
+    }
+
+    return refreshDevices() == 200;
 }
-bool SpotifyArduino::seek(int position, const char *deviceId)
+
+const SpotifyCachedDevice *SpotifyArduino::findDevice(const char *name)
 {
-    char command[100] = SPOTIFY_SEEK_ENDPOINT;
-    char tempBuff[100];
-    sprintf(tempBuff, "?position_ms=%d", position);
-    strcat(command, tempBuff);
-    if (deviceId[0] != 0)
+    if (!checkDeviceCache())
     {
-        sprintf(tempBuff, "?device_id=%s", deviceId);
-        strcat(command, tempBuff);
+        return NULL;
     }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-    printStack();
-#endif
+    for (int i = 0; i < _numDevices; i++)
+    {
+        if (strcasecmp(_devices[i].name, name) == 0)
+        {
+            return &_devices[i];
+        }
+    }
 
-    if (autoTokenRefresh)
+    return NULL;
+}
+
+const SpotifyCachedDevice *SpotifyArduino::findDeviceByType(const char *type)
+{
+    if (!checkDeviceCache())
     {
-        checkAndRefreshAccessToken();
+        return NULL;
     }
-    int statusCode = makePutRequest(command, _bearerToken);
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+
+    for (int i = 0; i < _numDevices; i++)
+    {
+        if (strcasecmp(_devices[i].type, type) == 0)
+        {
+            return &_devices[i];
+        }
+    }
+
+    return NULL;
 }
 
-bool SpotifyArduino::transferPlayback(const char *deviceId, bool play)
+const SpotifyCachedDevice *SpotifyArduino::getCachedDevice(int index)
+{
+    if (!checkDeviceCache() || index < 0 || index >= _numDevices)
+    {
+        return NULL;
+    }
+
+    return &_devices[index];
+}
+
+bool SpotifyBatch::addCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market)
 {
-    char body[100];
-    sprintf(body, "{\"device_ids\":[\"%s\"],\"play\":\"%s\"}", deviceId, (play ? "true" : "false"));
+    SpotifyBatchRequest *request = addRequest(batch_currently_playing, SPOTIFY_CURRENTLY_PLAYING_ENDPOINT);
+    if (request == NULL)
+    {
+        return false;
+    }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(SPOTIFY_PLAYER_ENDPOINT);
-    Serial.println(body);
-    printStack();
-#endif
+    if (market[0] != 0)
+    {
+        size_t length = strlen(request->command);
+        snprintf(request->command + length, sizeof(request->command) - length, "&market=%s", market);
+    }
+    request->callback.currentlyPlaying = currentlyPlayingCallback;
+    return true;
+}
+
+bool SpotifyBatch::addPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market)
+{
+    SpotifyBatchRequest *request = addRequest(batch_player_details, SPOTIFY_PLAYER_ENDPOINT);
+    if (request == NULL)
+    {
+        return false;
+    }
+
+    if (market[0] != 0)
+    {
+        size_t length = strlen(request->command);
+        snprintf(request->command + length, sizeof(request->command) - length, "?market=%s", market);
+    }
+    request->callback.playerDetails = playerDetailsCallback;
+    return true;
+}
+
+bool SpotifyBatch::addDevices(processDevices devicesCallback)
+{
+    SpotifyBatchRequest *request = addRequest(batch_devices, SPOTIFY_DEVICES_ENDPOINT);
+    if (request == NULL)
+    {
+        return false;
+    }
+
+    request->callback.devices = devicesCallback;
+    return true;
+}
+
+bool SpotifyBatch::addGet(const char *command, processResponse responseCallback)
+{
+    SpotifyBatchRequest *request = addRequest(batch_raw, command);
+    if (request == NULL)
+    {
+        return false;
+    }
+
+    request->callback.raw = responseCallback;
+    return true;
+}
+
+SpotifyBatchRequest *SpotifyBatch::addRequest(SpotifyBatchRequestType type, const char *command)
+{
+    if (numRequests >= SPOTIFY_MAX_BATCH_REQUESTS || strlen(command) >= sizeof(requests[0].command))
+    {
+        return NULL;
+    }
+
+    SpotifyBatchRequest *request = &requests[numRequests++];
+    request->type = type;
+    strcpy(request->command, command);
+    request->statusCode = 0;
+    return request;
+}
+
+int SpotifyArduino::executeBatch(SpotifyBatch &batch)
+{
+    SPOTIFY_LOG_DEBUG("Batch of ", batch.numRequests);
+    SPOTIFY_LOG_STACK();
 
     if (autoTokenRefresh)
     {
         checkAndRefreshAccessToken();
     }
-    int statusCode = makePutRequest(SPOTIFY_PLAYER_ENDPOINT, _bearerToken, body);
+    // Resolved before connecting, it may need a request of its own
+    const char *market = autoMarket ? getMarket() : "";
+
+    bool connected = false;
+    if (linkAvailable())
+    {
+        _deadlineClient.arm(deadlines[endpoint_other], cancelToken, tlsSessions);
+        client->flush();
+        client->setTimeout(SPOTIFY_TIMEOUT);
+        connected = client->connect(SPOTIFY_HOST, portNumber);
+        if (!connected)
+        {
+            connectFailed();
+        }
+    }
+
+    if (!connected)
+    {
+        for (int i = 0; i < batch.numRequests; i++)
+        {
+            batch.requests[i].statusCode = -1;
+        }
+        return 0;
+    }
+
+    // give the esp a breather
+    yield();
+
+    // Write every request before reading anything, the server answers them in order
+    for (int i = 0; i < batch.numRequests; i++)
+    {
+        client->print(F("GET "));
+        client->print(batch.requests[i].command);
+        if (autoMarket && (batch.requests[i].type == batch_currently_playing || batch.requests[i].type == batch_player_details) && strstr(batch.requests[i].command, "market=") == NULL)
+        {
+            client->print(strchr(batch.requests[i].command, '?') != NULL ? F("&market=") : F("?market="));
+            client->print(market);
+        }
+        client->println(F(" HTTP/1.1"));
+
+        client->print(F("Host: "));
+        client->println(SPOTIFY_HOST);
+        client->println(F("Accept: application/json"));
+        client->print(F("Authorization: "));
+        client->println(_bearerToken);
+        client->println(F("Cache-Control: no-cache"));
+        if (i == batch.numRequests - 1)
+        {
+            client->println(F("Connection: close"));
+        }
+
+        if (client->println() == 0)
+        {
+            SPOTIFY_LOG_ERROR("Failed to send request");
+            // Responses are only trustworthy for the requests that were fully written
+            for (int j = i; j < batch.numRequests; j++)
+            {
+                batch.requests[j].statusCode = -2;
+            }
+            batch.numRequests = i;
+            break;
+        }
+    }
+
+    int successful = 0;
+    SpotifyBodyStream body(client);
+    for (int i = 0; i < batch.numRequests; i++)
+    {
+        SpotifyBatchRequest &request = batch.requests[i];
+        request.statusCode = getHttpStatusCode();
+        if (request.statusCode < 0 || !readHeaders(body))
+        {
+            // Lost track of where we are in the stream, can't trust anything after this
+            for (int j = i; j < batch.numRequests; j++)
+            {
+                batch.requests[j].statusCode = -1;
+            }
+            break;
+        }
+
+        bool parsed = true;
+        if (request.statusCode == 200)
+        {
+            switch (request.type)
+            {
+            case batch_currently_playing:
+                parsed = parseCurrentlyPlaying(body, request.callback.currentlyPlaying);
+                break;
+            case batch_player_details:
+                parsed = parsePlayerDetails(body, request.callback.playerDetails);
+                break;
+            case batch_devices:
+                parsed = parseDevices(body, request.callback.devices);
+                break;
+            case batch_raw:
+                break;
+            }
+        }
+
+        if (request.type == batch_raw && request.callback.raw != NULL)
+        {
+            request.callback.raw(request.statusCode, body);
+        }
+
+        if (!parsed)
+        {
+            request.statusCode = -1;
+        }
+        else if (request.statusCode >= 200 && request.statusCode < 300)
+        {
+            successful++;
+        }
+
+        // Whatever the parser didn't need is still between us and the next response
+        body.drain();
+    }
+
     closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+    return successful;
 }
 
-int SpotifyArduino::getCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market)
+bool SpotifyArduino::readHeaders(SpotifyBodyStream &body)
 {
-    char command[75] = SPOTIFY_CURRENTLY_PLAYING_ENDPOINT;
-    if (market[0] != 0)
+    long contentLength = -1;
+    bool chunked = false;
+    char line[64];
+
+    // getHttpStatusCode stops at the '\r', finish off the status line
+    if (!client->find("\n"))
     {
-        char marketBuff[15];
-        sprintf(marketBuff, "&market=%s", market);
-        strcat(command, marketBuff);
+        return false;
     }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-    printStack();
-#endif
+    while (true)
+    {
+        size_t length = client->readBytesUntil('\n', line, sizeof(line) - 1);
+        if (length == 0)
+        {
+            // Timed out before the end of the headers
+            return false;
+        }
+        line[length] = '\0';
+
+        if (line[0] == '\r')
+        {
+            break;
+        }
+
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            contentLength = atol(line + 15);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked") != NULL)
+        {
+            chunked = true;
+        }
+    }
+
+    _contentLength = chunked ? -1 : contentLength;
+
+    body.begin(contentLength, chunked);
+    return true;
+}
 
+int SpotifyArduino::getDevices(processDevices devicesCallback)
+{
+    int statusCode = startGetRequest(SPOTIFY_DEVICES_ENDPOINT);
+    if (statusCode == 200 && !parseDevices(responseBody(), devicesCallback))
+    {
+        statusCode = -1;
+    }
+
+    closeClient();
+    return statusCode;
+}
+
+int SpotifyArduino::searchForSong(String query, int limit, processSearch searchCallback, SearchResult results[])
+{
     // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = currentlyPlayingBufferSize;
+    const size_t bufferSize = searchDetailsBufferSize;
 
-    if (autoTokenRefresh)
+    String command = SPOTIFY_SEARCH_ENDPOINT + query + "&limit=" + limit;
+    if (autoMarket && query.indexOf("market=") < 0)
     {
-        checkAndRefreshAccessToken();
+        command += "&market=";
+        command += getMarket();
     }
-    int statusCode = makeGetRequest(command, _bearerToken);
-#ifdef SPOTIFY_DEBUG
-    Serial.print("Status Code: ");
-    Serial.println(statusCode);
-    printStack();
-#endif
-    if (statusCode > 0)
+
+    int statusCode = startGetRequest(command.c_str());
+
+    if (statusCode == 200)
     {
-        skipHeaders();
+        // Only what's passed on in SearchResult, each item also has e.g. its available markets
+        StaticJsonDocument<320> filter;
+        JsonObject filter_item = filter["tracks"]["items"].createNestedObject();
+        filter_item["uri"] = true;
+        filter_item["name"] = true;
+        JsonObject filter_artist = filter_item["artists"].createNestedObject();
+        filter_artist["name"] = true;
+        filter_artist["uri"] = true;
+        JsonObject filter_album = filter_item.createNestedObject("album");
+        filter_album["uri"] = true;
+        filter_album["name"] = true;
+        JsonObject filter_image = filter_album["images"].createNestedObject();
+        filter_image["height"] = true;
+        filter_image["width"] = true;
+        filter_image["url"] = true;
+
+        // Allocate the document, from the arena if there is one
+        SpotifyJsonDocument doc(bufferSize, &_jsonArena);
+
+        // Parse JSON object
+        DeserializationError error = deserializeResponse(doc, responseBody(), filter, searchKeys, sizeof(searchKeys) / sizeof(searchKeys[0]));
+        if (!error)
+        {
+
+            uint8_t totalResults = doc["tracks"]["items"].size();
+
+            SPOTIFY_LOG_DEBUG("Total Results: ", totalResults);
+
+            SearchResult searchResult;
+            for (int i = 0; i < totalResults; i++)
+            {
+                //Polling track information
+                JsonObject result = doc["tracks"]["items"][i];
+                searchResult.trackUri = result["uri"].as<const char *>();
+                searchResult.trackName = result["name"].as<const char *>();
+                searchResult.albumUri = result["album"]["uri"].as<const char *>();
+                searchResult.albumName = result["album"]["name"].as<const char *>();
+
+                //Pull artist Information for the result
+                uint8_t totalArtists = result["artists"].size();
+                searchResult.numArtists = totalArtists;
+
+                SpotifyArtist artist;
+                for (int j = 0; j < totalArtists; j++)
+                {
+                    JsonObject artistResult = result["artists"][j];
+                    artist.artistName = artistResult["name"].as<const char *>();
+                    artist.artistUri = artistResult["uri"].as<const char *>();
+                    searchResult.artists[j] = artist;
+                }
+
+                uint8_t totalImages = result["album"]["images"].size();
+                searchResult.numImages = totalImages;
+
+                SpotifyImage image;
+                for (int j = 0; j < totalImages; j++)
+                {
+                    JsonObject imageResult = result["album"]["images"][j];
+                    image.height = imageResult["height"].as<int>();
+                    image.width = imageResult["width"].as<int>();
+                    image.url = imageResult["url"].as<const char *>();
+                    searchResult.albumImages[j] = image;
+                }
+
+                //Serial.println(searchResult.trackName);
+                results[i] = searchResult;
+
+                if (i >= limit || !searchCallback(searchResult, i, totalResults))
+                {
+                    //Break at the limit or when indicated
+                    break;
+                }
+            }
+        }
+        else
+        {
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+            statusCode = -1;
+        }
+    }
+
+    closeClient();
+    return statusCode;
+}
+
+bool SpotifyBufferImageSink::begin(long totalLength)
+{
+    if (buffer == NULL)
+    {
+        buffer = (uint8_t *)malloc(totalLength);
+        if (buffer == NULL)
+        {
+            SPOTIFY_LOG_ERROR("Could not allocate the image");
+            return false;
+        }
+        capacity = totalLength;
+    }
+    else if (totalLength > capacity)
+    {
+        SPOTIFY_LOG_ERROR("Image is too big for the buffer");
+        return false;
     }
+    return true;
+}
 
-    if (statusCode == 200)
+size_t SpotifyBufferImageSink::write(const uint8_t *data, size_t size)
+{
+    if (length + (long)size > capacity)
     {
-        CurrentlyPlaying current;
+        return 0;
+    }
+    memcpy(buffer + length, data, size);
+    length += size;
+    return size;
+}
 
-        //Apply Json Filter: https://arduinojson.org/v6/example/filter/
-        StaticJsonDocument<464> filter;
-        filter["is_playing"] = true;
-        filter["currently_playing_type"] = true;
-        filter["progress_ms"] = true;
-        filter["context"]["uri"] = true;
+int SpotifyArduino::commonGetImage(char *imageUrl, long rangeStart, bool &ranged)
+{
+    SPOTIFY_LOG_DEBUG("Parsing image URL: ", imageUrl);
 
-        JsonObject filter_item = filter.createNestedObject("item");
-        filter_item["duration_ms"] = true;
-        filter_item["name"] = true;
-        filter_item["uri"] = true;
+    uint8_t lengthOfString = strlen(imageUrl);
 
-        JsonObject filter_item_artists_0 = filter_item["artists"].createNestedObject();
-        filter_item_artists_0["name"] = true;
-        filter_item_artists_0["uri"] = true;
+    // We are going to just assume https, that's all I've
+    // seen and I can't imagine a company will go back
+    // to http
 
-        JsonObject filter_item_album = filter_item.createNestedObject("album");
-        filter_item_album["name"] = true;
-        filter_item_album["uri"] = true;
+    if (strncmp(imageUrl, "https://", 8) != 0)
+    {
+        SPOTIFY_LOG_ERROR("Url not in expected format (expected it to start with \"https://\"): ", imageUrl);
+        return false;
+    }
 
-        JsonObject filter_item_album_images_0 = filter_item_album["images"].createNestedObject();
-        filter_item_album_images_0["height"] = true;
-        filter_item_album_images_0["width"] = true;
-        filter_item_album_images_0["url"] = true;
+    uint8_t protocolLength = 8;
 
-        // Podcast filters
-        JsonObject filter_item_show = filter_item.createNestedObject("show");
-        filter_item_show["name"] = true;
-        filter_item_show["uri"] = true;
+    char *pathStart = strchr(imageUrl + protocolLength, '/');
+    uint8_t pathIndex = pathStart - imageUrl;
+    uint8_t pathLength = lengthOfString - pathIndex;
+    char path[pathLength + 1];
+    strncpy(path, pathStart, pathLength);
+    path[pathLength] = '\0';
 
-        JsonObject filter_item_images_0 = filter_item["images"].createNestedObject();
-        filter_item_images_0["height"] = true;
-        filter_item_images_0["width"] = true;
-        filter_item_images_0["url"] = true;
+    uint8_t hostLength = pathIndex - protocolLength;
+    char host[hostLength + 1];
+    strncpy(host, imageUrl + protocolLength, hostLength);
+    host[hostLength] = '\0';
 
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
+    SPOTIFY_LOG_DEBUG("host: ", host);
+    SPOTIFY_LOG_DEBUG("len:host:", hostLength);
+    SPOTIFY_LOG_DEBUG("path: ", path);
+    SPOTIFY_LOG_DEBUG("len:path: ", strlen(path));
 
-        // Parse JSON object
-#ifndef SPOTIFY_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client, DeserializationOption::Filter(filter));
-#else
-        ReadLoggingStream loggingStream(*client, Serial);
-        DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
-#endif
-        if (!error)
-        {
-#ifdef SPOTIFY_DEBUG
-            serializeJsonPretty(doc, Serial);
-#endif
-            JsonObject item = doc["item"];
+    int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host, rangeStart);
+    SPOTIFY_LOG_DEBUG("statusCode: ", statusCode);
+    if (statusCode == 200 || (rangeStart > 0 && statusCode == 206))
+    {
+        ranged = statusCode == 206;
+        return getContentLength();
+    }
 
-            const char *currently_playing_type = doc["currently_playing_type"];
+    // Failed
+    return -1;
+}
 
-            current.isPlaying = doc["is_playing"].as<bool>();
+SpotifyImageResult SpotifyArduino::downloadImage(char *imageUrl, SpotifyImageSink &sink)
+{
+    long totalLength = -1;
+    long received = 0;
+    int resumes = 0;
 
-            current.progressMs = doc["progress_ms"].as<long>();
-            current.durationMs = item["duration_ms"].as<long>();
+    while (true)
+    {
+        bool ranged = false;
+        long length = commonGetImage(imageUrl, received, ranged);
+        SPOTIFY_LOG_DEBUG("file length: ", length);
 
-            // context may be null
-            if (!doc["context"].isNull())
+        // Bytes at the start of this response we already have
+        long skip = 0;
+        if (length <= 0)
+        {
+            closeClient();
+            break;
+        }
+        else if (received == 0)
+        {
+            totalLength = length;
+            if (!sink.begin(totalLength))
             {
-                current.contextUri = doc["context"]["uri"].as<const char *>();
+                closeClient();
+                break;
             }
-            else
+        }
+        else if (ranged && received + length != totalLength)
+        {
+            SPOTIFY_LOG_ERROR("Resumed image is a different size");
+            closeClient();
+            break;
+        }
+        else if (!ranged)
+        {
+            // Server ignored the Range, throw away what we already have
+            if (length != totalLength)
             {
-                current.contextUri = NULL;
+                SPOTIFY_LOG_ERROR("Image changed between attempts");
+                closeClient();
+                break;
             }
+            skip = received;
+        }
 
-            // Check currently playing type
-            if (strcmp(currently_playing_type, "track") == 0)
-            {
-                current.currentlyPlayingType = track;
-            }
-            else if (strcmp(currently_playing_type, "episode") == 0)
-            {
-                current.currentlyPlayingType = episode;
-            }
-            else
-            {
-                current.currentlyPlayingType = other;
-            }
+        skipHeaders(false);
 
-            // If it's a song/track
-            if (current.currentlyPlayingType == track)
-            {
-                int numArtists = item["artists"].size();
-                if (numArtists > SPOTIFY_MAX_NUM_ARTISTS)
-                {
-                    numArtists = SPOTIFY_MAX_NUM_ARTISTS;
-                }
-                current.numArtists = numArtists;
+        // This section of code is inspired but the "Web_Jpg"
+        // example of TJpg_Decoder
+        // https://github.com/Bodmer/TJpg_Decoder
+        // -----------
+        uint8_t buff[128] = {0};
+        while (received < totalLength && (client->connected() || client->available() > 0))
+        {
+            // Get available data size
+            size_t size = client->available();
 
-                for (int i = 0; i < current.numArtists; i++)
+            if (size)
+            {
+                size_t wanted = (skip > 0) ? skip : totalLength - received;
+                if (size > wanted)
                 {
-                    current.artists[i].artistName = item["artists"][i]["name"].as<const char *>();
-                    current.artists[i].artistUri = item["artists"][i]["uri"].as<const char *>();
+                    size = wanted;
                 }
 
-                current.albumName = item["album"]["name"].as<const char *>();
-                current.albumUri = item["album"]["uri"].as<const char *>();
-
-                JsonArray images = item["album"]["images"];
-
-                // Images are returned in order of width, so last should be smallest.
-                int numImages = images.size();
-                int startingIndex = 0;
-                if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
-                {
-                    startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
-                    current.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
-                }
-                else
+                // Read up to 128 bytes
+                int c = client->read(buff, ((size > sizeof(buff)) ? sizeof(buff) : size));
+                if (c <= 0)
                 {
-                    current.numImages = numImages;
+                    continue;
                 }
-#ifdef SPOTIFY_DEBUG
-                Serial.print(F("Num Images: "));
-                Serial.println(current.numImages);
-                Serial.println(numImages);
-#endif
+                stats.imageBytesReceived += c;
 
-                for (int i = 0; i < current.numImages; i++)
+                if (skip > 0)
                 {
-                    int adjustedIndex = startingIndex + i;
-                    current.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
-                    current.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
-                    current.albumImages[i].url = images[adjustedIndex]["url"].as<const char *>();
+                    skip -= c;
                 }
-
-                current.trackName = item["name"].as<const char *>();
-                current.trackUri = item["uri"].as<const char *>();
-            }
-            else if (current.currentlyPlayingType == episode) // Podcast
-            {
-                current.numArtists = 1;
-
-                // Save Podcast as the "track"
-                current.trackName = item["name"].as<const char *>();
-                current.trackUri = item["uri"].as<const char *>();
-
-                // Save Show name as the "artist"
-                current.artists[0].artistName = item["show"]["name"].as<const char *>();
-                current.artists[0].artistUri = item["show"]["uri"].as<const char *>();
-
-                // Leave "album" name blank
-                char blank[1] = "";
-                current.albumName = blank;
-                current.albumUri = blank;
-
-                // Save the episode images as the "album art"
-                JsonArray images = item["images"];
-                // Images are returned in order of width, so last should be smallest.
-                int numImages = images.size();
-                int startingIndex = 0;
-                if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
+                else if (sink.write(buff, c) != (size_t)c)
                 {
-                    startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
-                    current.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+                    SPOTIFY_LOG_ERROR("Could not write the image");
+                    break;
                 }
                 else
                 {
-                    current.numImages = numImages;
-                }
-#ifdef SPOTIFY_DEBUG
-                Serial.print(F("Num Images: "));
-                Serial.println(current.numImages);
-                Serial.println(numImages);
-#endif
-
-                for (int i = 0; i < current.numImages; i++)
-                {
-                    int adjustedIndex = startingIndex + i;
-                    current.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
-                    current.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
-                    current.albumImages[i].url = images[adjustedIndex]["url"].as<const char *>();
+                    received += c;
                 }
             }
+            yield();
+        }
+// ---------
+        closeClient();
 
-            currentlyPlayingCallback(current);
+        if (received == totalLength)
+        {
+            SPOTIFY_LOG_DEBUG("Finished getting image");
+            return resumes > 0 ? image_resumed : image_complete;
         }
-        else
+
+        // A cancelled download stays cancelled, anything else can pick up where it left off
+        if (_deadlineClient.end == request_cancelled || resumes >= imageResumeAttempts)
         {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
-#endif
-            statusCode = -1;
+            break;
         }
+        resumes++;
+        stats.imageResumes++;
+        SPOTIFY_LOG_INFO("Image download dropped, resuming from ", received);
     }
 
-    closeClient();
-    return statusCode;
+    SPOTIFY_LOG_ERROR("Image download was incomplete");
+    return image_failed;
 }
 
-int SpotifyArduino::getPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market)
+SpotifyImageResult SpotifyArduino::getImage(char *imageUrl, Stream *file)
 {
-    char command[100] = SPOTIFY_PLAYER_ENDPOINT;
-    if (market[0] != 0)
+    // A failed download may have written part of the image to file
+    SpotifyStreamImageSink sink(file);
+    return downloadImage(imageUrl, sink);
+}
+
+SpotifyImageResult SpotifyArduino::getImage(char *imageUrl, uint8_t **image, int *imageLength)
+{
+    SpotifyBufferImageSink sink(NULL, 0);
+    SpotifyImageResult result = downloadImage(imageUrl, sink);
+    if (result == image_failed)
     {
-        char marketBuff[30];
-        sprintf(marketBuff, "?market=%s", market);
-        strcat(command, marketBuff);
+        // Don't hand back half an image
+        free(sink.buffer);
+        *image = NULL;
+        *imageLength = 0;
+        return image_failed;
     }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-    printStack();
-#endif
+    *image = sink.buffer;
+    *imageLength = sink.length;
+    return result;
+}
 
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = playerDetailsBufferSize;
-    if (autoTokenRefresh)
+int SpotifyArduino::getImageIntoBuffer(char *imageUrl, uint8_t *buffer, int bufferSize)
+{
+    SpotifyBufferImageSink sink(buffer, bufferSize);
+    if (downloadImage(imageUrl, sink) == image_failed)
     {
-        checkAndRefreshAccessToken();
+        return -1;
     }
+    return sink.length;
+}
 
-    int statusCode = makeGetRequest(command, _bearerToken);
-#ifdef SPOTIFY_DEBUG
-    Serial.print("Status Code: ");
-    Serial.println(statusCode);
-#endif
-    if (statusCode > 0)
+int SpotifyArduino::closestImageIndex(SpotifyImage images[], int numImages, int targetWidth)
+{
+    int bestIndex = -1;
+    int bestDifference = 0;
+    for (int i = 0; i < numImages; i++)
     {
-        skipHeaders();
+        int difference = abs(images[i].width - targetWidth);
+        if (bestIndex < 0 || difference < bestDifference)
+        {
+            bestIndex = i;
+            bestDifference = difference;
+        }
     }
 
-    if (statusCode == 200)
-    {
-
-        StaticJsonDocument<192> filter;
-        JsonObject filter_device = filter.createNestedObject("device");
-        filter_device["id"] = true;
-        filter_device["name"] = true;
-        filter_device["type"] = true;
-        filter_device["is_active"] = true;
-        filter_device["is_private_session"] = true;
-        filter_device["is_restricted"] = true;
-        filter_device["volume_percent"] = true;
-        filter["progress_ms"] = true;
-        filter["is_playing"] = true;
-        filter["shuffle_state"] = true;
-        filter["repeat_state"] = true;
+    return bestIndex;
+}
 
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
+bool SpotifyArduino::prefetchNextAlbumArt()
+{
+    // Get from https://arduinojson.org/v6/assistant/
+    const size_t bufferSize = queueBufferSize;
 
-        // Parse JSON object
-#ifndef SPOTIFY_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client, DeserializationOption::Filter(filter));
-#else
-        ReadLoggingStream loggingStream(*client, Serial);
-        DeserializationError error = deserializeJson(doc, loggingStream, DeserializationOption::Filter(filter));
-#endif
-        if (!error)
-        {
-            PlayerDetails playerDetails;
+    int statusCode = startGetRequest(SPOTIFY_QUEUE_ENDPOINT);
 
-            JsonObject device = doc["device"];
-            // Copy into buffer and make the last character a null just incase we went over.
-            playerDetails.device.id = device["id"].as<const char *>();
-            playerDetails.device.name = device["name"].as<const char *>();
-            playerDetails.device.type = device["type"].as<const char *>();
+    char trackUri[SPOTIFY_URI_CHAR_LENGTH] = "";
+    char imageUrl[SPOTIFY_URL_CHAR_LENGTH] = "";
 
-            playerDetails.device.isActive = device["is_active"].as<bool>();
-            playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
-            playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
-            playerDetails.device.volumePercent = device["volume_percent"].as<int>();
+    if (statusCode == 200)
+    {
+        StaticJsonDocument<256> filter;
+        JsonObject filter_queue_0 = filter["queue"].createNestedObject();
+        filter_queue_0["uri"] = true;
 
-            playerDetails.progressMs = doc["progress_ms"].as<long>();
-            playerDetails.isPlaying = doc["is_playing"].as<bool>();
+        JsonObject filter_queue_0_album_images_0 = filter_queue_0["album"]["images"].createNestedObject();
+        filter_queue_0_album_images_0["width"] = true;
+        filter_queue_0_album_images_0["url"] = true;
 
-            playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
+        // Podcast episodes have their images on the item itself
+        JsonObject filter_queue_0_images_0 = filter_queue_0["images"].createNestedObject();
+        filter_queue_0_images_0["width"] = true;
+        filter_queue_0_images_0["url"] = true;
 
-            const char *repeat_state = doc["repeat_state"];
+        // Allocate the document, from the arena if there is one
+        SpotifyJsonDocument doc(bufferSize, &_jsonArena);
 
-            if (strncmp(repeat_state, "track", 5) == 0)
+        // Parse JSON object
+        DeserializationError error = deserializeResponse(doc, responseBody(), filter, queueKeys, sizeof(queueKeys) / sizeof(queueKeys[0]));
+        if (!error)
+        {
+            JsonObject next = doc["queue"][0];
+            JsonArray images = next["album"]["images"];
+            if (images.isNull())
             {
-                playerDetails.repeateState = repeat_track;
+                images = next["images"];
             }
-            else if (strncmp(repeat_state, "context", 7) == 0)
+
+            // Same selection as getCurrentlyPlaying, so we pick from the images it will hand back
+            SpotifyImage albumImages[SPOTIFY_NUM_ALBUM_IMAGES];
+            int numImages = images.size();
+            int startingIndex = 0;
+            if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
             {
-                playerDetails.repeateState = repeat_context;
+                startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+                numImages = SPOTIFY_NUM_ALBUM_IMAGES;
             }
-            else
+
+            for (int i = 0; i < numImages; i++)
             {
-                playerDetails.repeateState = repeat_off;
+                albumImages[i].width = images[startingIndex + i]["width"].as<int>();
+                albumImages[i].url = images[startingIndex + i]["url"].as<const char *>();
             }
 
-            playerDetailsCallback(playerDetails);
+            int imageIndex = closestImageIndex(albumImages, numImages, prefetchImageWidth);
+            const char *uri = next["uri"].as<const char *>();
+            if (imageIndex >= 0 && uri != NULL && albumImages[imageIndex].url != NULL)
+            {
+                strncpy(trackUri, uri, sizeof(trackUri));
+                trackUri[sizeof(trackUri) - 1] = '\0';
+                strncpy(imageUrl, albumImages[imageIndex].url, sizeof(imageUrl));
+                imageUrl[sizeof(imageUrl) - 1] = '\0';
+            }
         }
         else
         {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
-#endif
-            statusCode = -1;
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
         }
     }
 
     closeClient();
-    return statusCode;
-}
-
-int SpotifyArduino::getDevices(processDevices devicesCallback)
-{
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(SPOTIFY_DEVICES_ENDPOINT);
-    printStack();
-#endif
+    if (trackUri[0] == 0)
+    {
+        // Nothing queued
+        return false;
+    }
 
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = getDevicesBufferSize;
-    if (autoTokenRefresh)
+    if (prefetchAudioFeatures)
     {
-        checkAndRefreshAccessToken();
+        preloadAudioFeatures(trackUri);
     }
 
-    int statusCode = makeGetRequest(SPOTIFY_DEVICES_ENDPOINT, _bearerToken);
-#ifdef SPOTIFY_DEBUG
-    Serial.print("Status Code: ");
-    Serial.println(statusCode);
-#endif
-    if (statusCode > 0)
+    if (_prefetch.imageLength > 0 && strcmp(_prefetch.url, imageUrl) == 0)
     {
-        skipHeaders();
+        // Next track shares the art we already have (e.g. same album)
+        strcpy(_prefetch.trackUri, trackUri);
+        return true;
     }
 
-    if (statusCode == 200)
+    if (_prefetch.image == NULL)
     {
+        _prefetch.image = (uint8_t *)malloc(prefetchBufferSize);
+        if (_prefetch.image == NULL)
+        {
+            SPOTIFY_LOG_ERROR("Could not allocate prefetch buffer");
+            return false;
+        }
+    }
 
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
+    // Invalidate the slot while it's being overwritten
+    _prefetch.imageLength = 0;
+    int imageLength = getImageIntoBuffer(imageUrl, _prefetch.image, prefetchBufferSize);
+    if (imageLength <= 0)
+    {
+        return false;
+    }
 
-        // Parse JSON object
-#ifndef SPOTIFY_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client);
-#else
-        ReadLoggingStream loggingStream(*client, Serial);
-        DeserializationError error = deserializeJson(doc, loggingStream);
-#endif
-        if (!error)
-        {
+    strcpy(_prefetch.trackUri, trackUri);
+    strcpy(_prefetch.url, imageUrl);
+    _prefetch.imageLength = imageLength;
+    return true;
+}
 
-            uint8_t totalDevices = doc["devices"].size();
+// Accepts "spotify:track:<id>" or just the id
+static const char *trackIdFromUri(const char *trackUri)
+{
+    const char *colon = strrchr(trackUri, ':');
+    if (colon == NULL)
+    {
+        return trackUri;
+    }
 
-            SpotifyDevice spotifyDevice;
-            for (int i = 0; i < totalDevices; i++)
-            {
-                JsonObject device = doc["devices"][i];
-                spotifyDevice.id = device["id"].as<const char *>();
-                spotifyDevice.name = device["name"].as<const char *>();
-                spotifyDevice.type = device["type"].as<const char *>();
+    if (strncmp(trackUri, "spotify:track:", 14) != 0)
+    {
+        // Episodes and local files don't have audio features
+        return NULL;
+    }
+    return colon + 1;
+}
 
-                spotifyDevice.isActive = device["is_active"].as<bool>();
-                spotifyDevice.isPrivateSession = device["is_private_session"].as<bool>();
-                spotifyDevice.isRestricted = device["is_restricted"].as<bool>();
-                spotifyDevice.volumePercent = device["volume_percent"].as<int>();
+SpotifyArduino::AudioFeaturesEntry *SpotifyArduino::findAudioFeaturesEntry(const char *trackUri)
+{
+    const char *trackId = trackIdFromUri(trackUri);
+    if (trackId == NULL)
+    {
+        return NULL;
+    }
 
-                if (!devicesCallback(spotifyDevice, i, totalDevices))
-                {
-                    //User has indicated they are finished.
-                    break;
-                }
-            }
-        }
-        else
+    for (int i = 0; i < SPOTIFY_AUDIO_FEATURES_CACHE_SIZE; i++)
+    {
+        if (_audioFeatures[i].statusCode != 0 && strcmp(_audioFeatures[i].features.trackId, trackId) == 0)
         {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
-#endif
-            statusCode = -1;
+            _audioFeatures[i].usedAt = ++_audioFeaturesTick;
+            return &_audioFeatures[i];
         }
     }
-
-    closeClient();
-    return statusCode;
+    return NULL;
 }
 
-int SpotifyArduino::searchForSong(String query, int limit, processSearch searchCallback, SearchResult results[])
+const SpotifyAudioFeatures *SpotifyArduino::findAudioFeatures(const char *trackUri)
 {
-
-#ifdef SPOTIFY_DEBUG
-    Serial.println(SPOTIFY_SEARCH_ENDPOINT);
-    printStack();
-#endif
-
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = searchDetailsBufferSize;
-    if (autoTokenRefresh)
+    AudioFeaturesEntry *entry = findAudioFeaturesEntry(trackUri);
+    if (entry == NULL || entry->statusCode != 200)
     {
-        checkAndRefreshAccessToken();
+        return NULL;
     }
+    return &entry->features;
+}
 
-    int statusCode = makeGetRequest((SPOTIFY_SEARCH_ENDPOINT + query + "&limit=" + limit).c_str(), _bearerToken);
-#ifdef SPOTIFY_DEBUG
-    Serial.print("Status Code: ");
-    Serial.println(statusCode);
-#endif
-    if (statusCode > 0)
+int SpotifyArduino::getAudioFeatures(const char *trackUri, SpotifyAudioFeatures *features)
+{
+    const char *trackId = (trackUri != NULL) ? trackIdFromUri(trackUri) : NULL;
+    if (trackId == NULL || strlen(trackId) >= SPOTIFY_TRACK_ID_CHAR_LENGTH)
     {
-        skipHeaders();
+        SPOTIFY_LOG_ERROR("No audio features for: ", trackUri);
+        return -1;
     }
 
-    if (statusCode == 200)
+    AudioFeaturesEntry *entry = findAudioFeaturesEntry(trackId);
+    if (entry != NULL)
     {
-
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
-
-        // Parse JSON object
-#ifndef SPOTIFY_PRINT_JSON_PARSE
-        DeserializationError error = deserializeJson(doc, *client);
-#else
-        ReadLoggingStream loggingStream(*client, Serial);
-        DeserializationError error = deserializeJson(doc, loggingStream);
-#endif
-        if (!error)
+        if (features != NULL && entry->statusCode == 200)
         {
+            *features = entry->features;
+        }
+        return entry->statusCode;
+    }
 
-            uint8_t totalResults = doc["tracks"]["items"].size();
-
-            Serial.print("Total Results: ");
-            Serial.println(totalResults);
-
-            SearchResult searchResult;
-            for (int i = 0; i < totalResults; i++)
-            {
-                //Polling track information
-                JsonObject result = doc["tracks"]["items"][i];
-                searchResult.trackUri = result["uri"].as<const char *>();
-                searchResult.trackName = result["name"].as<const char *>();
-                searchResult.albumUri = result["album"]["uri"].as<const char *>();
-                searchResult.albumName = result["album"]["name"].as<const char *>();
-
-                //Pull artist Information for the result
-                uint8_t totalArtists = result["artists"].size();
-                searchResult.numArtists = totalArtists;
-
-                SpotifyArtist artist;
-                for (int j = 0; j < totalArtists; j++)
-                {
-                    JsonObject artistResult = result["artists"][j];
-                    artist.artistName = artistResult["name"].as<const char *>();
-                    artist.artistUri = artistResult["uri"].as<const char *>();
-                    searchResult.artists[j] = artist;
-                }
-
-                uint8_t totalImages = result["album"]["images"].size();
-                searchResult.numImages = totalImages;
-
-                SpotifyImage image;
-                for (int j = 0; j < totalImages; j++)
-                {
-                    JsonObject imageResult = result["album"]["images"][j];
-                    image.height = imageResult["height"].as<int>();
-                    image.width = imageResult["width"].as<int>();
-                    image.url = imageResult["url"].as<const char *>();
-                    searchResult.albumImages[j] = image;
-                }
-
-                //Serial.println(searchResult.trackName);
-                results[i] = searchResult;
+    char command[sizeof(SPOTIFY_AUDIO_FEATURES_ENDPOINT) + SPOTIFY_TRACK_ID_CHAR_LENGTH] = SPOTIFY_AUDIO_FEATURES_ENDPOINT;
+    strcat(command, trackId);
 
-                if (i >= limit || !searchCallback(searchResult, i, totalResults))
-                {
-                    //Break at the limit or when indicated
-                    break;
-                }
-            }
+    int statusCode = startGetRequest(command);
+
+    SpotifyAudioFeatures parsed = {};
+    strcpy(parsed.trackId, trackId);
+    if (statusCode == 200)
+    {
+        StaticJsonDocument<144> filter;
+        for (uint8_t i = 0; i < sizeof(audioFeaturesKeys) / sizeof(audioFeaturesKeys[0]); i++)
+        {
+            filter[audioFeaturesKeys[i]] = true;
+        }
+
+        // Small enough to live on the stack
+        StaticJsonDocument<256> doc;
+        DeserializationError error = deserializeResponse(doc, responseBody(), filter, audioFeaturesKeys, sizeof(audioFeaturesKeys) / sizeof(audioFeaturesKeys[0]));
+        if (!error)
+        {
+            parsed.tempo = doc["tempo"].as<float>();
+            parsed.energy = doc["energy"].as<float>();
+            parsed.danceability = doc["danceability"].as<float>();
+            parsed.valence = doc["valence"].as<float>();
+            parsed.loudness = doc["loudness"].as<float>();
+            parsed.key = doc["key"].as<int>();
+            parsed.mode = doc["mode"].as<int>();
+            parsed.timeSignature = doc["time_signature"].as<int>();
         }
         else
         {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
-#endif
+            SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
             statusCode = -1;
         }
     }
 
     closeClient();
+
+    // Remember the answer unless it was something that could work next time
+    if (statusCode == 200 || statusCode == 403 || statusCode == 404)
+    {
+        entry = &_audioFeatures[0];
+        for (int i = 1; i < SPOTIFY_AUDIO_FEATURES_CACHE_SIZE; i++)
+        {
+            if (_audioFeatures[i].usedAt < entry->usedAt)
+            {
+                entry = &_audioFeatures[i];
+            }
+        }
+        entry->features = parsed;
+        entry->statusCode = statusCode;
+        entry->usedAt = ++_audioFeaturesTick;
+    }
+
+    if (features != NULL && statusCode == 200)
+    {
+        *features = parsed;
+    }
     return statusCode;
 }
 
-int SpotifyArduino::commonGetImage(char *imageUrl)
+bool SpotifyIdBatch::add(const char *uri)
 {
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("Parsing image URL: "));
-    Serial.println(imageUrl);
-#endif
-
-    uint8_t lengthOfString = strlen(imageUrl);
-
-    // We are going to just assume https, that's all I've
-    // seen and I can't imagine a company will go back
-    // to http
-
-    if (strncmp(imageUrl, "https://", 8) != 0)
+    const char *colon = strrchr(uri, ':');
+    const char *id = (colon != NULL) ? colon + 1 : uri;
+    size_t length = strlen(id);
+    if (length == 0 || length >= SPOTIFY_TRACK_ID_CHAR_LENGTH)
     {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.print(F("Url not in expected format: "));
-        Serial.println(imageUrl);
-        Serial.println("(expected it to start with \"https://\")");
-#endif
         return false;
     }
 
-    uint8_t protocolLength = 8;
-
-    char *pathStart = strchr(imageUrl + protocolLength, '/');
-    uint8_t pathIndex = pathStart - imageUrl;
-    uint8_t pathLength = lengthOfString - pathIndex;
-    char path[pathLength + 1];
-    strncpy(path, pathStart, pathLength);
-    path[pathLength] = '\0';
-
-    uint8_t hostLength = pathIndex - protocolLength;
-    char host[hostLength + 1];
-    strncpy(host, imageUrl + protocolLength, hostLength);
-    host[hostLength] = '\0';
-
-#ifdef SPOTIFY_DEBUG
-
-    Serial.print(F("host: "));
-    Serial.println(host);
-
-    Serial.print(F("len:host:"));
-    Serial.println(hostLength);
-
-    Serial.print(F("path: "));
-    Serial.println(path);
-
-    Serial.print(F("len:path: "));
-    Serial.println(strlen(path));
-#endif
+    if (knownCallback != NULL && knownCallback(id))
+    {
+        return true;
+    }
 
-    int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host);
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("statusCode: "));
-    Serial.println(statusCode);
-#endif
-    if (statusCode == 200)
+    for (int i = 0; i < numIds; i++)
     {
-        return getContentLength();
+        if (strcmp(ids[i], id) == 0)
+        {
+            return true;
+        }
     }
 
-    // Failed
-    return -1;
+    if (numIds >= SPOTIFY_MAX_LOOKUP_IDS)
+    {
+        return false;
+    }
+    strcpy(ids[numIds++], id);
+    return true;
 }
 
-bool SpotifyArduino::getImage(char *imageUrl, Stream *file)
+static void fillArtists(JsonArray artists, SpotifyArtist *out, int &numArtists)
 {
-    int totalLength = commonGetImage(imageUrl);
-
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("file length: "));
-    Serial.println(totalLength);
-#endif
-    if (totalLength > 0)
+    numArtists = artists.size();
+    if (numArtists > SPOTIFY_MAX_NUM_ARTISTS)
     {
-        skipHeaders(false);
-        int remaining = totalLength;
-        // This section of code is inspired but the "Web_Jpg"
-        // example of TJpg_Decoder
-        // https://github.com/Bodmer/TJpg_Decoder
-        // -----------
-        uint8_t buff[128] = {0};
-        while (client->connected() && (remaining > 0 || remaining == -1))
-        {
-            // Get available data size
-            size_t size = client->available();
+        numArtists = SPOTIFY_MAX_NUM_ARTISTS;
+    }
 
-            if (size)
-            {
-                // Read up to 128 bytes
-                int c = client->readBytes(buff, ((size > sizeof(buff)) ? sizeof(buff) : size));
+    for (int i = 0; i < numArtists; i++)
+    {
+        out[i].artistName = artists[i]["name"].as<const char *>();
+        out[i].artistUri = artists[i]["uri"].as<const char *>();
+    }
+}
 
-                // Write it to file
-                file->write(buff, c);
+static void fillImages(JsonArray images, SpotifyImage *out, int &numImages)
+{
+    // Images are returned in order of width, keep the smallest ones
+    numImages = images.size();
+    int startingIndex = 0;
+    if (numImages > SPOTIFY_NUM_ALBUM_IMAGES)
+    {
+        startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+        numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+    }
 
-                // Calculate remaining bytes
-                if (remaining > 0)
-                {
-                    remaining -= c;
-                }
-            }
-            yield();
-        }
-// ---------
-#ifdef SPOTIFY_DEBUG
-        Serial.println(F("Finished getting image"));
-#endif
+    for (int i = 0; i < numImages; i++)
+    {
+        out[i].height = images[startingIndex + i]["height"].as<int>();
+        out[i].width = images[startingIndex + i]["width"].as<int>();
+        out[i].url = images[startingIndex + i]["url"].as<const char *>();
     }
+}
 
-    closeClient();
+int SpotifyArduino::getTracks(SpotifyIdBatch &batch, processTrackDetails trackCallback, const char *market)
+{
+    return lookupIds(SPOTIFY_TRACKS_ENDPOINT, SPOTIFY_TRACKS_PER_REQUEST, batch, market, trackCallback, NULL);
+}
 
-    return (totalLength > 0); //Probably could be improved!
+int SpotifyArduino::getAlbums(SpotifyIdBatch &batch, processAlbumDetails albumCallback, const char *market)
+{
+    return lookupIds(SPOTIFY_ALBUMS_ENDPOINT, SPOTIFY_ALBUMS_PER_REQUEST, batch, market, NULL, albumCallback);
 }
 
-bool SpotifyArduino::getImage(char *imageUrl, uint8_t **image, int *imageLength)
+int SpotifyArduino::lookupIds(const char *endpoint, int perRequest, SpotifyIdBatch &batch, const char *market, processTrackDetails trackCallback, processAlbumDetails albumCallback)
 {
-    int totalLength = commonGetImage(imageUrl);
+    StaticJsonDocument<320> filter;
+    filter["id"] = true;
+    filter["name"] = true;
+    filter["uri"] = true;
+    JsonObject filter_artists_0 = filter["artists"].createNestedObject();
+    filter_artists_0["name"] = true;
+    filter_artists_0["uri"] = true;
+
+    JsonObject filter_images_0;
+    if (trackCallback != NULL)
+    {
+        filter["duration_ms"] = true;
+        JsonObject filter_album = filter.createNestedObject("album");
+        filter_album["name"] = true;
+        filter_album["uri"] = true;
+        filter_images_0 = filter_album["images"].createNestedObject();
+    }
+    else
+    {
+        filter["total_tracks"] = true;
+        filter["release_date"] = true;
+        filter_images_0 = filter["images"].createNestedObject();
+    }
+    filter_images_0["height"] = true;
+    filter_images_0["width"] = true;
+    filter_images_0["url"] = true;
 
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("file length: "));
-    Serial.println(totalLength);
-#endif
-    if (totalLength > 0)
+    // Looked up before the first request, resolving it may make a request of its own
+    market = marketFor(market);
+
+    int statusCode = 0;
+    for (int first = 0; first < batch.numIds; first += perRequest)
     {
-        skipHeaders(false);
-        uint8_t *imgPtr = (uint8_t *)malloc(totalLength);
-        *image = imgPtr;
-        *imageLength = totalLength;
-        int remaining = totalLength;
-        int amountRead = 0;
-
-#ifdef SPOTIFY_DEBUG
-        Serial.println(F("Fetching Image"));
-#endif
+        int last = first + perRequest;
+        if (last > batch.numIds)
+        {
+            last = batch.numIds;
+        }
 
-        // This section of code is inspired but the "Web_Jpg"
-        // example of TJpg_Decoder
-        // https://github.com/Bodmer/TJpg_Decoder
-        // -----------
-        uint8_t buff[128] = {0};
-        while (client->connected() && (remaining > 0 || remaining == -1))
+        SpotifyIdListPath path(endpoint, batch, first, last, market);
+        statusCode = startGetRequest(endpoint, path);
+
+        if (statusCode != 200)
         {
-            // Get available data size
-            size_t size = client->available();
+            closeClient();
+            return statusCode;
+        }
 
-            if (size)
-            {
-                // Read up to 128 bytes
-                int c = client->readBytes(buff, ((size > sizeof(buff)) ? sizeof(buff) : size));
+        // Reused for every item, so memory stays the same however many there are
+        SpotifyJsonDocument doc(lookupItemBufferSize, &_jsonArena);
 
-                // Write it to file
-                memcpy((uint8_t *)imgPtr + amountRead, (uint8_t *)buff, c);
+        // {"tracks":[{...},null,...]}, read one item at a time
+        Stream &body = responseBody();
+        bool keepGoing = body.find("[");
+        for (int index = first; keepGoing && index < last; index++)
+        {
+            // Items are parsed straight from the array, they don't go through deserializeResponse
+            DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
+            checkDocumentSize(error, doc);
+            if (error)
+            {
+                SPOTIFY_LOG_ERROR("deserializeJson() failed with code ", error.c_str());
+                statusCode = -1;
+                break;
+            }
 
-                // Calculate remaining bytes
-                if (remaining > 0)
+            // Unknown IDs come back as null
+            if (!doc.isNull())
+            {
+                if (trackCallback != NULL)
+                {
+                    SpotifyTrackDetails track;
+                    track.id = doc["id"].as<const char *>();
+                    track.name = doc["name"].as<const char *>();
+                    track.uri = doc["uri"].as<const char *>();
+                    track.durationMs = doc["duration_ms"].as<long>();
+                    track.albumName = doc["album"]["name"].as<const char *>();
+                    track.albumUri = doc["album"]["uri"].as<const char *>();
+                    fillArtists(doc["artists"], track.artists, track.numArtists);
+                    fillImages(doc["album"]["images"], track.albumImages, track.numImages);
+                    keepGoing = trackCallback(track, index, batch.numIds);
+                }
+                else
                 {
-                    amountRead += c;
-                    remaining -= c;
+                    SpotifyAlbumDetails album;
+                    album.id = doc["id"].as<const char *>();
+                    album.name = doc["name"].as<const char *>();
+                    album.uri = doc["uri"].as<const char *>();
+                    album.totalTracks = doc["total_tracks"].as<int>();
+                    album.releaseDate = doc["release_date"].as<const char *>();
+                    fillArtists(doc["artists"], album.artists, album.numArtists);
+                    fillImages(doc["images"], album.images, album.numImages);
+                    keepGoing = albumCallback(album, index, batch.numIds);
                 }
             }
-            yield();
+
+            // Either a comma before the next item or the end of the array
+            char separator = 0;
+            while (body.readBytes(&separator, 1) == 1 && separator != ',' && separator != ']')
+            {
+            }
+            if (separator != ',')
+            {
+                break;
+            }
         }
-// ---------
-#ifdef SPOTIFY_DEBUG
-        Serial.println(F("Finished getting image"));
-#endif
-    }
 
-    closeClient();
+        closeClient();
+        if (statusCode != 200 || !keepGoing)
+        {
+            break;
+        }
+    }
 
-    return (totalLength > 0); //Probably could be improved!
+    return statusCode;
 }
 
 int SpotifyArduino::getContentLength()
@@ -1205,10 +3331,7 @@ int SpotifyArduino::getContentLength()
     if (client->find("Content-Length:"))
     {
         int contentLength = client->parseInt();
-#ifdef SPOTIFY_DEBUG
-        Serial.print(F("Content-Length: "));
-        Serial.println(contentLength);
-#endif
+        SPOTIFY_LOG_DEBUG("Content-Length: ", contentLength);
         return contentLength;
     }
 
@@ -1217,12 +3340,89 @@ int SpotifyArduino::getContentLength()
 
 void SpotifyArduino::skipHeaders(bool tossUnexpectedForJSON)
 {
-    // Skip HTTP headers
-    if (!client->find("\r\n\r\n"))
+    // Skip HTTP headers, picking up the Content-Length on the way.
+    // We always start part way through a line (the status line or Content-Length)
+    if (_headersSkipped)
     {
-#ifdef SPOTIFY_SERIAL_OUTPUT
-        Serial.println(F("Invalid response"));
-#endif
+        // Already done while reading an error response
+        return;
+    }
+
+    const char contentLengthHeader[] = "content-length:";
+    const int contentLengthHeaderLength = sizeof(contentLengthHeader) - 1;
+    const char retryAfterHeader[] = "retry-after:";
+    const int retryAfterHeaderLength = sizeof(retryAfterHeader) - 1;
+    const char contentEncodingHeader[] = "content-encoding:";
+    const int contentEncodingHeaderLength = sizeof(contentEncodingHeader) - 1;
+    int lineLength = 1;
+    bool isContentLength = false;
+    bool isRetryAfter = false;
+    bool isContentEncoding = false;
+    bool gzipped = false;
+    _contentLength = -1;
+    while (true)
+    {
+        char c;
+        if (client->readBytes(&c, 1) != 1)
+        {
+            SPOTIFY_LOG_ERROR("Invalid response");
+            return;
+        }
+
+        if (c == '\n')
+        {
+            if (lineLength == 0)
+            {
+                break;
+            }
+            lineLength = 0;
+        }
+        else if (c != '\r')
+        {
+            if (lineLength == 0)
+            {
+                isContentLength = true;
+                isRetryAfter = true;
+                isContentEncoding = true;
+            }
+            if (lineLength < contentLengthHeaderLength && tolower(c) != contentLengthHeader[lineLength])
+            {
+                isContentLength = false;
+            }
+            if (lineLength < retryAfterHeaderLength && tolower(c) != retryAfterHeader[lineLength])
+            {
+                isRetryAfter = false;
+            }
+            if (lineLength < contentEncodingHeaderLength && tolower(c) != contentEncodingHeader[lineLength])
+            {
+                isContentEncoding = false;
+            }
+            lineLength++;
+            if (isContentLength && lineLength == contentLengthHeaderLength)
+            {
+                _contentLength = client->parseInt();
+            }
+            if (isRetryAfter && lineLength == retryAfterHeaderLength)
+            {
+                _lastError.retryAfterSeconds = client->parseInt();
+            }
+            if (isContentEncoding && lineLength == contentEncodingHeaderLength)
+            {
+                char encoding[16] = {0};
+                size_t length = client->readBytesUntil('\n', encoding, sizeof(encoding) - 1);
+                gzipped = strstr(encoding, "gzip") != NULL;
+                // readBytesUntil took the newline unless the value filled the buffer
+                lineLength = (length == sizeof(encoding) - 1) ? 1 : 0;
+            }
+        }
+    }
+
+    if (gzipped && _inflater != NULL)
+    {
+        // The body is read through the inflater from here on, see responseBody()
+        _inflater->begin(*client);
+        _gzipped = true;
+        stats.gzipResponses++;
         return;
     }
 
@@ -1234,40 +3434,32 @@ void SpotifyArduino::skipHeaders(bool tossUnexpectedForJSON)
         {
             char c = 0;
             client->readBytes(&c, 1);
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("Tossing an unexpected character: "));
-            Serial.println(c);
-#endif
+            SPOTIFY_LOG_DEBUG("Tossing an unexpected character: ", c);
         }
     }
 }
 
 int SpotifyArduino::getHttpStatusCode()
 {
+    // A new response, its headers haven't been read yet
+    _headersSkipped = false;
+    endGzip();
+
     char status[32] = {0};
     client->readBytesUntil('\r', status, sizeof(status));
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("Status: "));
-    Serial.println(status);
-#endif
+    SPOTIFY_LOG_DEBUG("Status: ", status);
 
     char *token;
     token = strtok(status, " "); // https://www.tutorialspoint.com/c_standard_library/c_function_strtok.htm
 
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("HTTP Version: "));
-    Serial.println(token);
-#endif
+    SPOTIFY_LOG_DEBUG("HTTP Version: ", token);
 
     if (token != NULL && (strcmp(token, "HTTP/1.0") == 0 || strcmp(token, "HTTP/1.1") == 0))
     {
         token = strtok(NULL, " ");
         if (token != NULL)
         {
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("Status Code: "));
-            Serial.println(token);
-#endif
+            SPOTIFY_LOG_DEBUG("Status Code: ", token);
             return atoi(token);
         }
     }
@@ -1275,22 +3467,135 @@ int SpotifyArduino::getHttpStatusCode()
     return -1;
 }
 
-void SpotifyArduino::parseError()
+void SpotifyArduino::resetLastError(int statusCode)
 {
-    //This method doesn't currently do anything other than print
-#ifdef SPOTIFY_SERIAL_OUTPUT
-    DynamicJsonDocument doc(1000);
-    DeserializationError error = deserializeJson(doc, *client);
-    if (!error)
+    _lastError.statusCode = statusCode;
+    _lastError.reason = reason_none;
+    _lastError.message[0] = '\0';
+    _lastError.retryAfterSeconds = 0;
+}
+
+void SpotifyArduino::readError(const char *host)
+{
+    // Image hosts don't send JSON errors, leave their response alone
+    if (strcmp(host, SPOTIFY_HOST) != 0 && strcmp(host, SPOTIFY_ACCOUNTS_HOST) != 0)
+    {
+        return;
+    }
+
+    skipHeaders();
+    _headersSkipped = true;
+    if (_lastError.statusCode == 429)
+    {
+        _lastError.reason = reason_rate_limited;
+    }
+    if (_contentLength == 0)
+    {
+        return;
+    }
+
+    // The API sends {"error":{"status":404,"message":"...","reason":"..."}},
+    // the accounts service {"error":"invalid_grant","error_description":"..."}
+    StaticJsonDocument<64> filter;
+    filter["error"] = true;
+    filter["error_description"] = true;
+
+    StaticJsonDocument<384> doc;
+    DeserializationError error = deserializeJson(doc, responseBody(), DeserializationOption::Filter(filter));
+    if (error)
+    {
+        SPOTIFY_LOG_ERROR("Could not parse error: ", error.c_str());
+        return;
+    }
+
+    JsonVariant details = doc["error"];
+    const char *message;
+    if (details.is<JsonObject>())
     {
-        Serial.print(F("getAuthToken error"));
-        serializeJson(doc, Serial);
+        message = details["message"].as<const char *>();
+        const char *reason = details["reason"].as<const char *>();
+        if (reason != NULL)
+        {
+            _lastError.reason = reason_unknown;
+            for (uint8_t i = 0; i < sizeof(errorReasons) / sizeof(errorReasons[0]); i++)
+            {
+                if (strcmp(reason, errorReasons[i]) == 0)
+                {
+                    _lastError.reason = (SpotifyErrorReason)(reason_no_prev_track + i);
+                    break;
+                }
+            }
+        }
     }
     else
     {
-        Serial.print(F("Could not parse error"));
+        message = doc["error_description"].as<const char *>();
+        if (message == NULL)
+        {
+            message = details.as<const char *>();
+        }
     }
-#endif
+
+    if (message != NULL)
+    {
+        strncpy(_lastError.message, message, sizeof(_lastError.message) - 1);
+        _lastError.message[sizeof(_lastError.message) - 1] = '\0';
+    }
+    SPOTIFY_LOG_ERROR("Error response: ", _lastError.message);
+}
+
+bool SpotifyArduino::refreshForRetry(int statusCode, const char *authorization)
+{
+    // Once per call, never for the token request itself, and only if
+    // there's a refresh token to get a new one with
+    if (statusCode != 401 || !refreshOnUnauthorized || _retrying || authorization != _bearerToken || _refreshToken == NULL)
+    {
+        return false;
+    }
+
+    closeClient();
+    SPOTIFY_LOG_INFO("Access token was rejected, refreshing it and trying again");
+    if (!refreshAccessToken())
+    {
+        return false;
+    }
+
+    stats.recoveries++;
+    return true;
+}
+
+const char *SpotifyArduino::transferToFallback(int statusCode, const char *deviceId)
+{
+    // Only for commands meant for whichever device is active, and not for
+    // the transfer made here
+    if (statusCode != 404 || _lastError.reason != reason_no_active_device || fallbackDeviceName == NULL || deviceId[0] != 0 || _fallingBack)
+    {
+        return NULL;
+    }
+
+    // Looking up or transferring to the device may make requests of its own,
+    // if it doesn't work out the caller should still see NO_ACTIVE_DEVICE
+    SpotifyError noActiveDevice = _lastError;
+    const SpotifyCachedDevice *device = findDevice(fallbackDeviceName);
+    if (device == NULL)
+    {
+        SPOTIFY_LOG_ERROR("Fallback device not found: ", fallbackDeviceName);
+        _lastError = noActiveDevice;
+        return NULL;
+    }
+
+    SPOTIFY_LOG_INFO("No active device, transferring playback to ", device->name);
+    _fallingBack = true;
+    bool transferred = transferPlayback(device->id);
+    _fallingBack = false;
+    if (!transferred)
+    {
+        _lastError = noActiveDevice;
+        return NULL;
+    }
+
+    stats.recoveries++;
+    return device->id;
 }
 
 void SpotifyArduino::lateInit(const char *clientId, const char *clientSecret, const char *refreshToken)
@@ -1300,22 +3605,50 @@ void SpotifyArduino::lateInit(const char *clientId, const char *clientSecret, co
     setRefreshToken(refreshToken);
 }
 
+Stream &SpotifyArduino::responseBody()
+{
+    if (_gzipped)
+    {
+        return *_inflater;
+    }
+    return *client;
+}
+
+void SpotifyArduino::endGzip()
+{
+    if (!_gzipped)
+    {
+        return;
+    }
+
+    _gzipped = false;
+    stats.compressedBytes += _inflater->bytesIn;
+    stats.uncompressedBytes += _inflater->bytesOut;
+    if (_inflater->error() != inflate_ok)
+    {
+        stats.gzipFailures++;
+        SPOTIFY_LOG_ERROR("Could not inflate the response, error: ", (long)_inflater->error());
+    }
+}
+
 void SpotifyArduino::closeClient()
 {
+    endGzip();
+
+    // The response has been dealt with, however long the callbacks took
+    // this isn't a timeout
+    _deadlineClient.disarm();
     if (client->connected())
     {
-#ifdef SPOTIFY_DEBUG
-        Serial.println(F("Closing client"));
-#endif
+        SPOTIFY_LOG_DEBUG("Closing client");
         client->stop();
     }
 }
 
-#ifdef SPOTIFY_DEBUG
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_DEBUG
 void SpotifyArduino::printStack()
 {
     char stack;
-    Serial.print(F("stack size "));
-    Serial.println(stack_start - &stack);
+    SPOTIFY_LOG_DEBUG("stack size ", (long)(stack_start - &stack));
 }
 #endif
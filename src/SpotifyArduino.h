@@ -26,17 +26,24 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 // NOTE: Do not use this option on live-streams, it will reveal your
 // private tokens!
 
-#define SPOTIFY_DEBUG 1
+//#define SPOTIFY_DEBUG 1
 
 // Comment out if you want to disable any serial output from this library (also comment out DEBUG and PRINT_JSON_PARSE)
 #define SPOTIFY_SERIAL_OUTPUT 1
 
+// Or pick the level directly (SPOTIFY_LOG_LEVEL_NONE/ERROR/INFO/DEBUG), anything
+// above it is compiled out. See SpotifyLog.h for sending the output somewhere
+// other than Serial.
+//#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_ERROR
+
 // Prints the JSON received to serial (only use for debugging as it will be slow)
 //#define SPOTIFY_PRINT_JSON_PARSE 1
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <Client.h>
+#include "SpotifyLog.h"
+#include "SpotifyInflateStream.h"
 
 #ifdef SPOTIFY_PRINT_JSON_PARSE
 #include <StreamUtils.h>
@@ -60,11 +67,16 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #define SPOTIFY_DEVICE_ID_CHAR_LENGTH 45
 #define SPOTIFY_DEVICE_NAME_CHAR_LENGTH 80
 #define SPOTIFY_DEVICE_TYPE_CHAR_LENGTH 30
+#define SPOTIFY_ERROR_MESSAGE_CHAR_LENGTH 80 // Longer messages are cut off
 
 #define SPOTIFY_CURRENTLY_PLAYING_ENDPOINT "/v1/me/player/currently-playing?additional_types=episode"
 
 #define SPOTIFY_PLAYER_ENDPOINT "/v1/me/player"
+#define SPOTIFY_PLAYER_STATE_ENDPOINT "/v1/me/player?additional_types=episode"
 #define SPOTIFY_DEVICES_ENDPOINT "/v1/me/player/devices"
+#define SPOTIFY_QUEUE_ENDPOINT "/v1/me/player/queue"
+#define SPOTIFY_USER_ENDPOINT "/v1/me"
+#define SPOTIFY_MARKET_FROM_TOKEN "from_token"
 
 #define SPOTIFY_PLAY_ENDPOINT "/v1/me/player/play"
 #define SPOTIFY_SEARCH_ENDPOINT "/v1/search"
@@ -78,6 +90,10 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define SPOTIFY_SEEK_ENDPOINT "/v1/me/player/seek"
 
+#define SPOTIFY_AUDIO_FEATURES_ENDPOINT "/v1/audio-features/"
+#define SPOTIFY_TRACKS_ENDPOINT "/v1/tracks?ids="
+#define SPOTIFY_ALBUMS_ENDPOINT "/v1/albums?ids="
+
 #define SPOTIFY_TOKEN_ENDPOINT "/api/token"
 
 #define SPOTIFY_NUM_ALBUM_IMAGES 3 // Max spotify returns is 3, but the third one is probably too big for an ESP
@@ -86,6 +102,22 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define SPOTIFY_ACCESS_TOKEN_LENGTH 309
 
+#define SPOTIFY_MAX_BATCH_REQUESTS 4
+
+#define SPOTIFY_MAX_FORM_FIELDS 5
+#define SPOTIFY_MAX_PLAY_URIS 10
+
+#define SPOTIFY_MAX_CACHED_DEVICES 6
+
+#define SPOTIFY_TRACK_ID_CHAR_LENGTH 24
+#define SPOTIFY_AUDIO_FEATURES_CACHE_SIZE 4 // Enough for the current track, the queued one and a couple of skips back
+
+#define SPOTIFY_MAX_LOOKUP_IDS 50
+#define SPOTIFY_TRACKS_PER_REQUEST 50 // The most Spotify takes in one go
+#define SPOTIFY_ALBUMS_PER_REQUEST 20
+
+#define SPOTIFY_TOKEN_DOC_SIZE 640 // Room for both the access and refresh token
+
 enum RepeatOptions
 {
   repeat_track,
@@ -118,6 +150,21 @@ struct SpotifyDevice
   int volumePercent;
 };
 
+// A copy of a device that stays valid after the callback returns. It can be
+// passed anywhere a deviceId is expected.
+struct SpotifyCachedDevice
+{
+  char id[SPOTIFY_DEVICE_ID_CHAR_LENGTH];
+  char name[SPOTIFY_DEVICE_NAME_CHAR_LENGTH];
+  char type[SPOTIFY_DEVICE_TYPE_CHAR_LENGTH];
+  bool isActive;
+  bool isRestricted;
+  bool isPrivateSession;
+  int volumePercent;
+
+  operator const char *() const { return id; }
+};
+
 struct PlayerDetails
 {
   SpotifyDevice device;
@@ -161,12 +208,505 @@ struct CurrentlyPlaying
   long durationMs;
   const char *contextUri;
   SpotifyPlayingType currentlyPlayingType;
+  const uint8_t *prefetchedImage; // Album art already downloaded by prefetchNextAlbumArt, NULL if not available
+  int prefetchedImageLength;
+};
+
+// Last known player state, kept up to date by polls and successful player commands
+struct SpotifyPlayerState
+{
+  bool isPlaying;
+  int volumePercent;
+  bool shuffleState;
+  RepeatOptions repeatState;
+  bool known; // false until the first poll or successful command
+};
+
+enum SpotifyPlayerStateField
+{
+  player_state_playing,
+  player_state_volume,
+  player_state_shuffle,
+  player_state_repeat,
+  player_state_field_count
+};
+
+// Player commands sent by sendPlayerCommand, each has an entry in the
+// descriptor table at the top of SpotifyArduino.cpp
+enum SpotifyPlayerCommand
+{
+  player_play,
+  player_pause,
+  player_volume,
+  player_shuffle,
+  player_repeat,
+  player_next,
+  player_previous,
+  player_seek
+};
+
+struct SpotifyAudioFeatures
+{
+  char trackId[SPOTIFY_TRACK_ID_CHAR_LENGTH];
+  float tempo;        // Beats per minute
+  float energy;       // 0.0 to 1.0
+  float danceability; // 0.0 to 1.0
+  float valence;      // 0.0 (sad, angry) to 1.0 (happy, cheerful)
+  float loudness;     // Average dB, usually between -60 and 0
+  int key;            // Pitch class, 0 is C, -1 if none was detected
+  int mode;           // 1 major, 0 minor
+  int timeSignature;  // Beats per bar
+};
+
+struct SpotifyTrackDetails
+{
+  const char *id;
+  const char *name;
+  const char *uri;
+  SpotifyArtist artists[SPOTIFY_MAX_NUM_ARTISTS];
+  int numArtists;
+  const char *albumName;
+  const char *albumUri;
+  SpotifyImage albumImages[SPOTIFY_NUM_ALBUM_IMAGES];
+  int numImages;
+  long durationMs;
+};
+
+struct SpotifyAlbumDetails
+{
+  const char *id;
+  const char *name;
+  const char *uri;
+  SpotifyArtist artists[SPOTIFY_MAX_NUM_ARTISTS];
+  int numArtists;
+  SpotifyImage images[SPOTIFY_NUM_ALBUM_IMAGES];
+  int numImages;
+  int totalTracks;
+  const char *releaseDate;
+};
+
+struct SpotifyPrefetchedImage
+{
+  char trackUri[SPOTIFY_URI_CHAR_LENGTH];
+  char url[SPOTIFY_URL_CHAR_LENGTH];
+  uint8_t *image;
+  int imageLength;
 };
 
 typedef void (*processCurrentlyPlaying)(CurrentlyPlaying currentlyPlaying);
 typedef void (*processPlayerDetails)(PlayerDetails playerDetails);
 typedef bool (*processDevices)(SpotifyDevice device, int index, int numDevices);
 typedef bool (*processSearch)(SearchResult result, int index, int numResults);
+typedef void (*processResponse)(int statusCode, Stream &body);
+typedef bool (*processTrackDetails)(SpotifyTrackDetails track, int index, int numTracks);
+typedef bool (*processAlbumDetails)(SpotifyAlbumDetails album, int index, int numAlbums);
+typedef bool (*isIdKnown)(const char *id);
+
+// IDs for getTracks/getAlbums to look up. Duplicates, and any
+// knownCallback already has, are left out so they're never requested.
+struct SpotifyIdBatch
+{
+  char ids[SPOTIFY_MAX_LOOKUP_IDS][SPOTIFY_TRACK_ID_CHAR_LENGTH];
+  int numIds = 0;
+  isIdKnown knownCallback = NULL;
+
+  bool add(const char *uri); // URI or ID, false if it's full or not a valid ID
+  void clear() { numIds = 0; }
+};
+
+// Writes a request body straight to the client. It gets called twice,
+// once to work out the Content-Length and once to actually send it.
+class SpotifyBodyWriter
+{
+public:
+  virtual void writeBody(Print &out) = 0;
+};
+
+class SpotifyLengthCounter : public Print
+{
+public:
+  size_t length = 0;
+  size_t write(uint8_t) { length++; return 1; }
+  size_t write(const uint8_t *, size_t size) { length += size; return size; }
+};
+
+class SpotifyStringBody : public SpotifyBodyWriter
+{
+public:
+  SpotifyStringBody(const char *body) : _body(body) {}
+  void writeBody(Print &out);
+
+private:
+  const char *_body;
+};
+
+// application/x-www-form-urlencoded body, values need to be encoded already
+class SpotifyFormBody : public SpotifyBodyWriter
+{
+public:
+  void add(const __FlashStringHelper *name, const char *value);
+  void writeBody(Print &out);
+
+private:
+  const __FlashStringHelper *_names[SPOTIFY_MAX_FORM_FIELDS];
+  const char *_values[SPOTIFY_MAX_FORM_FIELDS];
+  int _numFields = 0;
+};
+
+// Body for playAdvanced, anything left unset is left out of the request
+class SpotifyPlayOptions : public SpotifyBodyWriter
+{
+public:
+  const char *contextUri = NULL;   // Album, artist or playlist
+  const char *trackUris[SPOTIFY_MAX_PLAY_URIS];
+  int numTrackUris = 0;
+  const char *offsetUri = NULL;    // Track in the context to start at, takes priority over offsetPosition
+  int offsetPosition = -1;         // Index of the track in the context to start at
+  long positionMs = -1;            // Where in the track to start
+
+  bool addTrackUri(const char *uri);
+  void writeBody(Print &out);
+};
+
+// Sits between a response body and deserializeJson and keeps track of which
+// top level fields have been read. Once all of them have, it closes the root
+// object itself so the rest of the body is never pulled through the client.
+class SpotifyJsonCutoff : public Stream
+{
+public:
+  SpotifyJsonCutoff(Stream &source, const char *const *keys, uint8_t numKeys);
+  bool complete = false;        // Stopped before the end of the body
+  unsigned long bytesRead = 0;  // Bytes taken from the source
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t) { return 0; }
+
+private:
+  Stream &_source;
+  const char *const *_keys;
+  uint8_t _numKeys;
+  uint32_t _seen = 0;
+  int8_t _currentKey = -1;
+  bool _firstOnly = false;
+  bool _inArray = false;
+  bool _inValue = false;
+  bool _inString = false;
+  bool _escape = false;
+  bool _readingKey = false;
+  bool _done = false;
+  uint8_t _depth = 0;
+  char _key[24];
+  uint8_t _keyLength = 0;
+  int _peeked = -1;
+  char _pending = 0;
+  int next();
+  int readSource();
+  int8_t matchKey();
+};
+
+// Which deadlines a request gets, worked out from its host and path
+enum SpotifyEndpointClass
+{
+  endpoint_token,          // accounts.spotify.com
+  endpoint_player_state,   // GETs under /v1/me/player
+  endpoint_player_control, // PUTs and POSTs under /v1/me/player
+  endpoint_devices,
+  endpoint_search,
+  endpoint_image, // Anything not on api.spotify.com, i.e. album art
+  endpoint_other, // Batches and the rest of the API
+  endpoint_class_count
+};
+
+// Budgets for each phase of one request, 0 means no limit.
+// connect() itself can't be interrupted, it is checked once it returns.
+struct SpotifyDeadlines
+{
+  unsigned long connectMs;
+  unsigned long firstByteMs; // From connected until the first byte of the response
+  unsigned long bodyMs;      // From the first byte until the end of the response
+  unsigned long overallMs;
+};
+
+// Owned by the sketch. Once cancelled, every request fails straight away
+// (an in-flight one at its next read) until it is reset. cancel() is safe
+// to call from an interrupt. A token with a parent also counts as cancelled
+// once the parent is.
+struct SpotifyCancelToken
+{
+  volatile bool cancelled = false;
+  SpotifyCancelToken *parent = NULL;
+  void cancel() { cancelled = true; }
+  void reset() { cancelled = false; }
+  bool isCancelled() const { return cancelled || (parent != NULL && parent->isCancelled()); }
+};
+
+// Implement this for a TLS client that can resume sessions (session IDs or
+// tickets), the library calls it around every connect so the full handshake
+// only has to happen once per host.
+class SpotifyTlsSessionStore
+{
+public:
+  virtual ~SpotifyTlsSessionStore() {}
+  // Before connecting, give the client the session saved for this host, if any
+  virtual void offerSession(const char *host) = 0;
+  // After a successful connect, keep the session for next time.
+  // Return true if the handshake resumed the offered session.
+  virtual bool saveSession(const char *host) = 0;
+};
+
+enum SpotifyRequestEnd
+{
+  request_completed,
+  request_connect_timeout,
+  request_first_byte_timeout,
+  request_body_timeout,
+  request_overall_timeout,
+  request_cancelled
+};
+
+// The "reason" Spotify gives for a failed player command
+enum SpotifyErrorReason
+{
+  reason_none, // The request worked, or Spotify didn't say why it failed
+  reason_unknown,
+  reason_no_prev_track,
+  reason_no_next_track,
+  reason_no_specific_track,
+  reason_already_paused,
+  reason_not_paused,
+  reason_not_playing_locally,
+  reason_not_playing_track,
+  reason_not_playing_context,
+  reason_endless_context,
+  reason_context_disallow,
+  reason_already_playing,
+  reason_rate_limited,
+  reason_remote_control_disallow,
+  reason_device_not_controllable,
+  reason_volume_control_disallow,
+  reason_no_active_device,
+  reason_premium_required
+};
+
+// Why the last request failed, decoded from the error response on the stack
+struct SpotifyError
+{
+  int statusCode; // As returned by the method, negative if there was no response
+  SpotifyErrorReason reason;
+  char message[SPOTIFY_ERROR_MESSAGE_CHAR_LENGTH];
+  long retryAfterSeconds; // From a 429's Retry-After header, 0 if there wasn't one
+};
+
+struct SpotifyStats
+{
+  unsigned long responsesParsed;
+  unsigned long bodyBytesParsed; // Bytes of JSON bodies read by the parser
+  unsigned long bodyBytesUnread; // Bytes of JSON bodies never read because every needed field was already in
+  long lastBodySize; // Size of the last body as sent, whether it was all read or not
+  long lastBodyBytesParsed;
+  long lastBodyBytesUnread;
+  unsigned long timeouts;
+  unsigned long cancellations;
+  unsigned long tlsFullHandshakes;
+  unsigned long tlsResumedHandshakes;
+  unsigned long connectsSkipped; // Requests failed straight away because the journal knew the link was down
+  unsigned long imageBytesReceived; // Including any bytes a resume had to throw away
+  unsigned long imageResumes;
+  unsigned long documentsTooSmall; // Parses that ran out of room, raise the matching xBufferSize
+  unsigned long recoveries; // Failed requests fixed by refreshOnUnauthorized/fallbackDeviceName and sent again
+  unsigned long gzipResponses;
+  unsigned long compressedBytes;   // Bytes of gzip bodies read off the network
+  unsigned long uncompressedBytes; // What those bytes inflated to
+  unsigned long gzipFailures;      // Bodies that couldn't be inflated, e.g. the window was too small
+};
+
+// Sits between the library and the sketch's client. Every read goes through
+// it, so once a deadline passes or the request is cancelled the connection
+// is dropped and all the find/readBytes/parse calls return straight away
+// instead of each waiting out their own timeout.
+class SpotifyDeadlineClient : public Client
+{
+public:
+  void setClient(Client *client, SpotifyStats *stats);
+  void arm(const SpotifyDeadlines &deadlines, SpotifyCancelToken *cancelToken, SpotifyTlsSessionStore *sessions);
+  void disarm(); // Until the next arm(), nothing times out or is cancelled
+  SpotifyRequestEnd end = request_completed;
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(const char *host, uint16_t port);
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *buf, size_t size);
+  int available();
+  int read();
+  int read(uint8_t *buf, size_t size);
+  int peek();
+  void flush() { _client->flush(); }
+  void stop() { _client->stop(); }
+  uint8_t connected();
+  operator bool() { return _client != NULL && (bool)*_client; }
+
+private:
+  Client *_client = NULL;
+  SpotifyStats *_stats = NULL;
+  SpotifyDeadlines _deadlines = {};
+  SpotifyCancelToken *_cancelToken = NULL;
+  SpotifyTlsSessionStore *_sessions = NULL;
+  unsigned long _startedAt = 0;
+  unsigned long _phaseStartedAt = 0;
+  bool _gotFirstByte = false;
+  bool expired();
+  bool checkConnect(int result);
+  void gotData();
+};
+
+// Only the body of one HTTP response, so several can be read back to back from one connection
+class SpotifyBodyStream : public Stream
+{
+public:
+  SpotifyBodyStream(Client *client);
+  void begin(long contentLength, bool chunked); // contentLength of -1 means read until the server closes
+  long drain();                                 // Skips the rest of the body, returns how many bytes were skipped
+
+  int available();
+  int read();
+  int peek();
+  size_t readBytes(char *buffer, size_t length);
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+  size_t write(uint8_t) { return 0; }
+
+private:
+  Client *_client;
+  long _remaining;
+  bool _chunked;
+  bool _done;
+  bool prepare();
+  void consumed(long count);
+  bool nextChunk();
+};
+
+// Both getImage methods can be treated as a bool, only image_failed is false
+enum SpotifyImageResult
+{
+  image_failed,
+  image_complete,
+  image_resumed // Complete, but the connection dropped at least once on the way
+};
+
+// Where an image download goes, told the full size before the first byte arrives
+class SpotifyImageSink : public Print
+{
+public:
+  virtual bool begin(long) { return true; }
+  size_t write(uint8_t b) { return write(&b, 1); }
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+};
+
+class SpotifyStreamImageSink : public SpotifyImageSink
+{
+public:
+  SpotifyStreamImageSink(Print *out) : _out(out) {}
+  size_t write(const uint8_t *buffer, size_t size) { return _out->write(buffer, size); }
+
+private:
+  Print *_out;
+};
+
+// Writes into buffer, or one malloc'd to fit if buffer is NULL
+class SpotifyBufferImageSink : public SpotifyImageSink
+{
+public:
+  SpotifyBufferImageSink(uint8_t *buffer, long capacity) : buffer(buffer), capacity(capacity) {}
+  bool begin(long totalLength);
+  size_t write(const uint8_t *data, size_t size);
+  uint8_t *buffer;
+  long capacity;
+  long length = 0;
+};
+
+// One block of memory every JSON document borrows in turn, so parsing never
+// goes near the heap once it's set up. Until begin() is called documents
+// are malloc'd and freed as usual.
+class SpotifyJsonArena
+{
+public:
+  bool begin(uint8_t *memory, size_t size); // memory NULL to malloc it once here
+  size_t size() { return _size; }
+  bool inUse() { return _inUse; }
+
+  void *allocate(size_t size);
+  void deallocate(void *pointer);
+  void *reallocate(void *pointer, size_t size);
+
+private:
+  uint8_t *_memory = NULL;
+  size_t _size = 0;
+  bool _inUse = false;
+};
+
+// Without an arena it's the same as ArduinoJson's default allocator
+struct SpotifyArenaAllocator
+{
+  SpotifyJsonArena *arena;
+  SpotifyArenaAllocator(SpotifyJsonArena *arena = NULL) : arena(arena) {}
+  void *allocate(size_t size) { return arena != NULL ? arena->allocate(size) : malloc(size); }
+  void deallocate(void *pointer)
+  {
+    if (arena != NULL)
+    {
+      arena->deallocate(pointer);
+    }
+    else
+    {
+      free(pointer);
+    }
+  }
+  void *reallocate(void *pointer, size_t size) { return arena != NULL ? arena->reallocate(pointer, size) : realloc(pointer, size); }
+};
+
+typedef BasicJsonDocument<SpotifyArenaAllocator> SpotifyJsonDocument;
+
+enum SpotifyBatchRequestType
+{
+  batch_currently_playing,
+  batch_player_details,
+  batch_devices,
+  batch_raw
+};
+
+struct SpotifyBatchRequest
+{
+  SpotifyBatchRequestType type;
+  char command[100];
+  union
+  {
+    processCurrentlyPlaying currentlyPlaying;
+    processPlayerDetails playerDetails;
+    processDevices devices;
+    processResponse raw;
+  } callback;
+  int statusCode; // Filled in by executeBatch
+};
+
+// Several GET requests that executeBatch sends back to back on one connection
+struct SpotifyBatch
+{
+  SpotifyBatchRequest requests[SPOTIFY_MAX_BATCH_REQUESTS];
+  int numRequests = 0;
+
+  bool addCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market = "");
+  bool addPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market = "");
+  bool addDevices(processDevices devicesCallback);
+  bool addGet(const char *command, processResponse responseCallback); // For anything else on api.spotify.com, e.g. the queue
+  void clear() { numRequests = 0; }
+
+private:
+  SpotifyBatchRequest *addRequest(SpotifyBatchRequestType type, const char *command);
+};
+
+class SpotifyStatePublisher;
+class SpotifyCommandJournal;
 
 class SpotifyArduino
 {
@@ -182,17 +722,33 @@ public:
   const char *requestAccessTokens(const char *code, const char *redirectUrl);
 
   // Generic Request Methods
-  int makeGetRequest(const char *command, const char *authorization, const char *accept = "application/json", const char *host = SPOTIFY_HOST);
+  int makeGetRequest(const char *command, const char *authorization, const char *accept = "application/json", const char *host = SPOTIFY_HOST, long rangeStart = 0);
   int makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
+  int makeRequestWithBody(const char *type, const char *command, const char *authorization, SpotifyBodyWriter &body, const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
   int makePostRequest(const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
+  int makePostRequest(const char *command, const char *authorization, SpotifyBodyWriter &body, const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
   int makePutRequest(const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
+  int makePutRequest(const char *command, const char *authorization, SpotifyBodyWriter &body, const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
 
   // User methods
+  void setMarket(const char *market);
+  const char *getMarket();
+  int resolveMarket();
   int getCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market = "");
   int getPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market = "");
+  int getPlayerState(processPlayerDetails playerDetailsCallback, processCurrentlyPlaying currentlyPlayingCallback, const char *market = "");
   int getDevices(processDevices devicesCallback);
+  int refreshDevices() { return getDevices(NULL); }
+  // The cache leaves out restricted devices, they can't be controlled
+  const SpotifyCachedDevice *findDevice(const char *name);
+  const SpotifyCachedDevice *findDeviceByType(const char *type);
+  const SpotifyCachedDevice *getCachedDevice(int index);
+  int getNumCachedDevices() { return _numDevices; }
+  void invalidateDevices() { _devicesFetchedAt = 0; _numDevices = 0; }
+  int executeBatch(SpotifyBatch &batch);
   bool play(const char *deviceId = "");
   bool playAdvanced(char *body, const char *deviceId = "");
+  bool playAdvanced(SpotifyPlayOptions &options, const char *deviceId = "");
   bool pause(const char *deviceId = "");
   bool setVolume(int volume, const char *deviceId = "");
   bool toggleShuffle(bool shuffle, const char *deviceId = "");
@@ -200,48 +756,163 @@ public:
   bool nextTrack(const char *deviceId = "");
   bool previousTrack(const char *deviceId = "");
   bool playerControl(char *command, const char *deviceId = "", const char *body = "");
+  bool playerControl(char *command, const char *deviceId, SpotifyBodyWriter &body);
   bool playerNavigate(char *command, const char *deviceId = "");
   bool seek(int position, const char *deviceId = "");
   bool transferPlayback(const char *deviceId, bool play = false);
+  const SpotifyPlayerState &getCachedPlayerState() { return _playerState; }
+  int replayJournal();
+
+  // Metadata for many tracks/albums, as few requests as possible. Each
+  // item is passed to the callback as it's read, index being its place
+  // in the batch. Returns the status of the last request, 0 if the batch is empty.
+  int getTracks(SpotifyIdBatch &batch, processTrackDetails trackCallback, const char *market = "");
+  int getAlbums(SpotifyIdBatch &batch, processAlbumDetails albumCallback, const char *market = "");
 
   //Search
   int searchForSong(String query, int limit, processSearch searchCallback, SearchResult results[]);
 
   // Image methods
-  bool getImage(char *imageUrl, Stream *file);
-  bool getImage(char *imageUrl, uint8_t **image, int *imageLength);
+  SpotifyImageResult getImage(char *imageUrl, Stream *file);
+  SpotifyImageResult getImage(char *imageUrl, uint8_t **image, int *imageLength);
+  static int closestImageIndex(SpotifyImage images[], int numImages, int targetWidth);
+
+  // Every parse reuses one block instead of allocating its own. Pass NULL
+  // to have it malloc'd here, and 0 for exactly jsonArenaSizeNeeded().
+  // Fails if the block is smaller than the biggest xBufferSize.
+  bool useJsonArena(uint8_t *memory = NULL, size_t size = 0);
+  size_t jsonArenaSizeNeeded();
+
+  // Asks api.spotify.com for gzip and inflates the responses as they are
+  // parsed. Takes the window plus around 750 bytes, window NULL to malloc it.
+  // A response that refers back further than the window fails, so only pass
+  // a smaller size if you know how big the responses you make get.
+  bool useGzip(uint8_t *window = NULL, size_t size = SPOTIFY_GZIP_WINDOW_SIZE);
+
+  // Audio features, each track is only ever requested once while it's in the cache.
+  // Takes a track URI or ID, returns 200 if features was filled in.
+  int getAudioFeatures(const char *trackUri, SpotifyAudioFeatures *features);
+  int preloadAudioFeatures(const char *trackUri) { return getAudioFeatures(trackUri, NULL); }
+  const SpotifyAudioFeatures *findAudioFeatures(const char *trackUri); // Cache only, never makes a request
+
+  // Prefetch methods
+  bool prefetchNextAlbumArt();
 
   int portNumber = 443;
   int currentlyPlayingBufferSize = 3000;
   int playerDetailsBufferSize = 2000;
   int getDevicesBufferSize = 3000;
   int searchDetailsBufferSize = 3000;
+  int queueBufferSize = 4000;
+  int lookupItemBufferSize = 1500; // One track or album of getTracks/getAlbums, only one is in memory at a time
+  int prefetchImageWidth = 300;     // Prefetched art will be the album image closest to this width
+  int prefetchBufferSize = 32768;   // Max size of a prefetched image, allocated once on first prefetch
+  bool prefetchAudioFeatures = false; // prefetchNextAlbumArt also preloads the queued track's audio features
+  int imageResumeAttempts = 2;      // Times an image download that dropped part way is picked up again with a Range request
   bool autoTokenRefresh = true;
-  Client *client;
+  bool refreshOnUnauthorized = false; // On a 401, refresh the access token and send the request once more
+  const char *fallbackDeviceName = NULL; // On NO_ACTIVE_DEVICE, transfer playback to this device (see findDevice) and send the command once more
+  bool autoMarket = false; // Add the user's market to requests that return tracks when none is passed in
+  SpotifyStats stats = {};
+  SpotifyStatePublisher *statePublisher = NULL; // Every parsed currently playing/player details is also published here
+  SpotifyCommandJournal *journal = NULL; // Player commands that fail because the link is down are kept here for replayJournal
+  unsigned long deviceCacheTtlMs = 60000; // Device lookups only go back to Spotify once the cache is older than this
+  unsigned long confirmationWindowMs = 3000; // How long a polled value is ignored after a command changed it locally
+  Client *client; // Every request goes through this, it wraps the client passed in
+  SpotifyDeadlines deadlines[endpoint_class_count] = {
+      {5000, 3000, 2000, 8000},   // endpoint_token
+      {5000, 2000, 3000, 8000},   // endpoint_player_state
+      {5000, 3000, 1000, 8000},   // endpoint_player_control
+      {5000, 2000, 3000, 8000},   // endpoint_devices
+      {5000, 3000, 5000, 10000},  // endpoint_search
+      {5000, 3000, 20000, 30000}, // endpoint_image
+      {5000, 3000, 5000, 12000}}; // endpoint_other
+  SpotifyCancelToken *cancelToken = NULL;
+  SpotifyTlsSessionStore *tlsSessions = NULL;
+  SpotifyRequestEnd getLastRequestEnd() { return _deadlineClient.end; }
+  const SpotifyError &getLastError() { return _lastError; } // Of the last request made, including any recovery
+  unsigned long worstCaseMs(SpotifyEndpointClass endpoint);
   void lateInit(const char *clientId, const char *clientSecret, const char *refreshToken = "");
 
-#ifdef SPOTIFY_DEBUG
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_DEBUG
   char *stack_start;
 #endif
 
 private:
   char _bearerToken[SPOTIFY_ACCESS_TOKEN_LENGTH + 10]; //10 extra is for "bearer " at the start
-  char *_refreshToken;
+  char *_refreshToken = NULL;
   const char *_clientId;
   const char *_clientSecret;
   unsigned int timeTokenRefreshed;
   unsigned int tokenTimeToLiveMs;
-  int commonGetImage(char *imageUrl);
+  SpotifyPrefetchedImage _prefetch = {};
+  struct AudioFeaturesEntry
+  {
+    SpotifyAudioFeatures features;
+    int statusCode; // What Spotify said, so tracks without features aren't asked about again
+    uint32_t usedAt;
+  };
+  AudioFeaturesEntry _audioFeatures[SPOTIFY_AUDIO_FEATURES_CACHE_SIZE] = {};
+  uint32_t _audioFeaturesTick = 0;
+  AudioFeaturesEntry *findAudioFeaturesEntry(const char *trackUri);
+  int lookupIds(const char *endpoint, int perRequest, SpotifyIdBatch &batch, const char *market, processTrackDetails trackCallback, processAlbumDetails albumCallback);
+  SpotifyPlayerState _playerState = {};
+  unsigned long _pendingSince[player_state_field_count] = {};
+  uint8_t _pendingFields = 0;
+  void setPending(SpotifyPlayerStateField field);
+  bool checkPending(SpotifyPlayerStateField field, bool pollAgrees);
+  void reconcilePlayerState(PlayerDetails &playerDetails);
+  void reconcilePlayerState(CurrentlyPlaying &current);
+  void addCurrentlyPlayingFilter(JsonDocument &filter);
+  void addPlayerDetailsFilter(JsonDocument &filter);
+  void fillCurrentlyPlaying(JsonDocument &doc, CurrentlyPlaying &current);
+  void fillPlayerDetails(JsonDocument &doc, PlayerDetails &playerDetails);
+  bool parseCurrentlyPlaying(Stream &body, processCurrentlyPlaying currentlyPlayingCallback);
+  bool parsePlayerDetails(Stream &body, processPlayerDetails playerDetailsCallback);
+  bool parseDevices(Stream &body, processDevices devicesCallback);
+  bool readHeaders(SpotifyBodyStream &body);
+  void checkDocumentSize(DeserializationError error, JsonDocument &doc);
+  DeserializationError deserializeResponse(JsonDocument &doc, Stream &body, JsonDocument &filter, const char *const *keys, uint8_t numKeys);
+  long _contentLength = -1;
+  SpotifyDeadlineClient _deadlineClient;
+  void setClient(Client &client);
+  void armDeadlines(const char *type, const char *command, const char *host);
+  bool linkAvailable();
+  void connectFailed();
+  void journalCommand(int command, long value, const char *deviceId);
+  bool sendPlayerCommand(SpotifyPlayerCommand type, long value, const char *deviceId);
+  bool playerRequest(const char *type, const char *command, const char *deviceId, SpotifyBodyWriter &body, bool allowFallback = true);
+  int startGetRequest(const char *command);
+  int startGetRequest(const char *command, SpotifyBodyWriter &path);
+  int sendGetRequest(const char *command, SpotifyBodyWriter &path, const char *authorization, const char *accept, const char *host, long rangeStart);
+  char _market[12] = "";
+  SpotifyCachedDevice _devices[SPOTIFY_MAX_CACHED_DEVICES];
+  uint8_t _numDevices = 0;
+  unsigned long _devicesFetchedAt = 0;
+  bool checkDeviceCache();
+  const char *marketFor(const char *market); // The one passed in, or the user's with autoMarket
+  void appendMarket(char *command, const char *market);
+  int commonGetImage(char *imageUrl, long rangeStart, bool &ranged);
+  SpotifyImageResult downloadImage(char *imageUrl, SpotifyImageSink &sink);
+  int getImageIntoBuffer(char *imageUrl, uint8_t *buffer, int bufferSize);
   int getContentLength();
+  SpotifyJsonArena _jsonArena;
+  SpotifyInflateStream *_inflater = NULL;
+  bool _gzipped = false; // The current response is being read through _inflater
+  Stream &responseBody();
+  void endGzip();
   int getHttpStatusCode();
   void skipHeaders(bool tossUnexpectedForJSON = true);
   void closeClient();
-  void parseError();
-  const char *requestAccessTokensBody =
-      R"(grant_type=authorization_code&code=%s&redirect_uri=%s&client_id=%s&client_secret=%s)";
-  const char *refreshAccessTokensBody =
-      R"(grant_type=refresh_token&refresh_token=%s&client_id=%s&client_secret=%s)";
-#ifdef SPOTIFY_DEBUG
+  SpotifyError _lastError = {};
+  bool _headersSkipped = false;
+  bool _retrying = false;
+  bool _fallingBack = false;
+  void resetLastError(int statusCode);
+  void readError(const char *host);
+  bool refreshForRetry(int statusCode, const char *authorization);
+  const char *transferToFallback(int statusCode, const char *deviceId);
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_DEBUG
   void printStack();
 #endif
 };
@@ -0,0 +1,179 @@
+/*
+SpotifyCommandJournal - Keeps player commands that could not be sent
+while the network was down and boils them down for replay.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "SpotifyCommandJournal.h"
+
+bool SpotifyCommandJournal::canConnect()
+{
+    if (linkCheck != NULL)
+    {
+        if (!linkCheck())
+        {
+            if (!_down)
+            {
+                _down = true;
+                _downSince = millis();
+            }
+            _waitingForLink = true;
+            return false;
+        }
+
+        if (_waitingForLink)
+        {
+            // Just came back, no need to wait out the retry interval
+            _waitingForLink = false;
+            _down = false;
+            return true;
+        }
+    }
+
+    return !_down || millis() - _downSince >= retryIntervalMs;
+}
+
+bool SpotifyCommandJournal::isLinkDown()
+{
+    return _down;
+}
+
+void SpotifyCommandJournal::linkFailed()
+{
+    // Restarts the wait, so a link that stays down costs one connect per retryIntervalMs
+    _down = true;
+    _downSince = millis();
+}
+
+void SpotifyCommandJournal::linkWorked()
+{
+    _down = false;
+}
+
+bool SpotifyCommandJournal::record(SpotifyJournalCommand command, long value, const char *deviceId)
+{
+    bool full = _count == SPOTIFY_JOURNAL_SIZE;
+    if (full)
+    {
+        _first = (_first + 1) % SPOTIFY_JOURNAL_SIZE;
+        _count--;
+        dropped++;
+    }
+
+    SpotifyJournalEntry &entry = _entries[(_first + _count) % SPOTIFY_JOURNAL_SIZE];
+    entry.command = command;
+    entry.value = value;
+    entry.recordedAt = millis();
+    entry.deviceId[0] = '\0';
+    if (deviceId != NULL)
+    {
+        strncat(entry.deviceId, deviceId, sizeof(entry.deviceId) - 1);
+    }
+    _count++;
+
+    SPOTIFY_LOG_INFO("Journaled command: ", (long)command);
+    return !full;
+}
+
+bool SpotifyCommandJournal::superseded(uint8_t index)
+{
+    const SpotifyJournalEntry &entry = _entries[(_first + index) % SPOTIFY_JOURNAL_SIZE];
+    for (uint8_t i = index + 1; i < _count; i++)
+    {
+        const SpotifyJournalEntry &later = _entries[(_first + i) % SPOTIFY_JOURNAL_SIZE];
+        if (strcmp(later.deviceId, entry.deviceId) != 0)
+        {
+            continue;
+        }
+
+        switch (entry.command)
+        {
+        case journal_play:
+        case journal_pause:
+            if (later.command == journal_play || later.command == journal_pause)
+            {
+                return true;
+            }
+            break;
+        case journal_volume:
+        case journal_shuffle:
+        case journal_repeat:
+            if (later.command == entry.command)
+            {
+                return true;
+            }
+            break;
+        case journal_seek:
+            // Also a position in the track being skipped away from
+            if (later.command == journal_seek || later.command == journal_next || later.command == journal_previous)
+            {
+                return true;
+            }
+            break;
+        default:
+            // Skips don't cancel each other, previous can restart the
+            // current track rather than undo a next
+            return false;
+        }
+    }
+
+    return false;
+}
+
+int SpotifyCommandJournal::compact()
+{
+    // Kept entries only ever move towards the front, so it can be done in place
+    unsigned long now = millis();
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        const SpotifyJournalEntry &entry = _entries[(_first + i) % SPOTIFY_JOURNAL_SIZE];
+        if (now - entry.recordedAt > maxAgeMs)
+        {
+            stale++;
+            continue;
+        }
+        if (superseded(i))
+        {
+            continue;
+        }
+
+        if (kept != i)
+        {
+            _entries[(_first + kept) % SPOTIFY_JOURNAL_SIZE] = entry;
+        }
+        kept++;
+    }
+
+    _count = kept;
+    return _count;
+}
+
+bool SpotifyCommandJournal::take(SpotifyJournalEntry &entry)
+{
+    if (_count == 0)
+    {
+        return false;
+    }
+
+    entry = _entries[_first];
+    _first = (_first + 1) % SPOTIFY_JOURNAL_SIZE;
+    _count--;
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+SpotifyCommandJournal - Keeps player commands that could not be sent
+while the network was down and boils them down for replay.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef SpotifyCommandJournal_h
+#define SpotifyCommandJournal_h
+
+#include "SpotifyArduino.h"
+
+#define SPOTIFY_JOURNAL_SIZE 8
+
+// Same order as SpotifyPlayerCommand, plus transfer
+enum SpotifyJournalCommand
+{
+  journal_play,
+  journal_pause,
+  journal_volume,
+  journal_shuffle,
+  journal_repeat,
+  journal_next,
+  journal_previous,
+  journal_seek,
+  journal_transfer
+};
+
+struct SpotifyJournalEntry
+{
+  SpotifyJournalCommand command;
+  long value; // Volume, shuffle, repeat mode, seek position or transfer's play flag
+  unsigned long recordedAt;
+  char deviceId[SPOTIFY_DEVICE_ID_CHAR_LENGTH]; // "" for the active device
+};
+
+typedef bool (*checkLink)();
+
+// Set as a SpotifyArduino's journal. Once a connect fails the link counts as
+// down, requests fail straight away without trying to connect until
+// retryIntervalMs has passed, and player commands are recorded here instead
+// of being lost. replayJournal() then sends what's left in one go.
+class SpotifyCommandJournal
+{
+public:
+  // Link state, kept up to date by SpotifyArduino
+  bool canConnect();
+  bool isLinkDown();
+  void linkFailed();
+  void linkWorked();
+
+  bool record(SpotifyJournalCommand command, long value, const char *deviceId);
+  int size() { return _count; }
+  void clear() { _count = 0; }
+
+  // Drops entries older than maxAgeMs and ones a later entry for the same
+  // device makes pointless (an earlier volume, play/pause, shuffle, repeat or
+  // seek, or a seek followed by a skip). Skips and transfers are always kept,
+  // in the order they were made. Returns how many are left.
+  int compact();
+  // Takes the oldest entry out of the journal
+  bool take(SpotifyJournalEntry &entry);
+
+  checkLink linkCheck = NULL;      // Optional, e.g. return WiFi.status() == WL_CONNECTED
+  unsigned long retryIntervalMs = 15000; // How long to wait after a failed connect before trying again
+  unsigned long maxAgeMs = 60000;        // Older entries are left out of the replay
+  unsigned long dropped = 0; // Oldest entries pushed out because the journal was full
+  unsigned long stale = 0;   // Entries left out for being older than maxAgeMs
+
+private:
+  SpotifyJournalEntry _entries[SPOTIFY_JOURNAL_SIZE];
+  uint8_t _first = 0;
+  uint8_t _count = 0;
+  bool _down = false;
+  bool _waitingForLink = false;
+  unsigned long _downSince = 0;
+
+  bool superseded(uint8_t index);
+};
+
+#endif
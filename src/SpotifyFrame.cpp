@@ -0,0 +1,425 @@
+/*
+SpotifyFrame - Compact binary frames of the playback state, for passing
+it on to other boards over UART, ESP-NOW etc.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#include "SpotifyFrame.h"
+
+void SpotifyFrameEncoder::reset()
+{
+    memset(_hashes, 0, sizeof(_hashes));
+    _sent = 0;
+}
+
+size_t SpotifyFrameEncoder::write(const CurrentlyPlaying *currentlyPlaying, const PlayerDetails *playerDetails, bool delta, uint8_t *buffer, size_t size)
+{
+    _buffer = buffer;
+    _size = size;
+    _length = 0;
+    _overflow = false;
+    _fields = 0;
+
+    writeByte(SPOTIFY_FRAME_VERSION);
+    writeByte(delta ? 1 : 0);
+    writeByte(_sequence);
+    // Field mask, filled in at the end
+    for (int i = 0; i < 4; i++)
+    {
+        writeByte(0);
+    }
+
+    // Fields have to go in the order of SpotifyFrameField
+    size_t start;
+    if (currentlyPlaying != NULL)
+    {
+        start = _length;
+        writeString(currentlyPlaying->trackName);
+        endField(frame_track_name, start, delta);
+
+        start = _length;
+        writeString(currentlyPlaying->trackUri);
+        endField(frame_track_uri, start, delta);
+
+        start = _length;
+        writeVarint(currentlyPlaying->numArtists);
+        for (int i = 0; i < currentlyPlaying->numArtists; i++)
+        {
+            writeString(currentlyPlaying->artists[i].artistName);
+        }
+        endField(frame_artists, start, delta);
+
+        start = _length;
+        writeString(currentlyPlaying->albumName);
+        endField(frame_album_name, start, delta);
+
+        start = _length;
+        writeString(currentlyPlaying->albumUri);
+        endField(frame_album_uri, start, delta);
+
+        start = _length;
+        writeVarint(currentlyPlaying->numImages);
+        for (int i = 0; i < currentlyPlaying->numImages; i++)
+        {
+            writeVarint(currentlyPlaying->albumImages[i].width);
+            writeVarint(currentlyPlaying->albumImages[i].height);
+            writeString(currentlyPlaying->albumImages[i].url);
+        }
+        endField(frame_album_images, start, delta);
+
+        start = _length;
+        writeString(currentlyPlaying->contextUri);
+        endField(frame_context_uri, start, delta);
+
+        start = _length;
+        writeVarint(currentlyPlaying->currentlyPlayingType);
+        endField(frame_playing_type, start, delta);
+
+        start = _length;
+        writeVarint(currentlyPlaying->durationMs > 0 ? currentlyPlaying->durationMs : 0);
+        endField(frame_duration, start, delta);
+    }
+
+    long progressMs = (currentlyPlaying != NULL) ? currentlyPlaying->progressMs : playerDetails->progressMs;
+    bool isPlaying = (currentlyPlaying != NULL) ? currentlyPlaying->isPlaying : playerDetails->isPlaying;
+
+    start = _length;
+    writeSigned(progressMs);
+    endField(frame_progress, start, delta);
+
+    start = _length;
+    writeByte(isPlaying);
+    endField(frame_is_playing, start, delta);
+
+    if (playerDetails != NULL)
+    {
+        start = _length;
+        writeString(playerDetails->device.id);
+        endField(frame_device_id, start, delta);
+
+        start = _length;
+        writeString(playerDetails->device.name);
+        endField(frame_device_name, start, delta);
+
+        start = _length;
+        writeString(playerDetails->device.type);
+        endField(frame_device_type, start, delta);
+
+        start = _length;
+        writeByte((playerDetails->device.isActive ? 1 : 0) | (playerDetails->device.isRestricted ? 2 : 0) | (playerDetails->device.isPrivateSession ? 4 : 0));
+        endField(frame_device_flags, start, delta);
+
+        start = _length;
+        writeSigned(playerDetails->device.volumePercent);
+        endField(frame_volume, start, delta);
+
+        start = _length;
+        writeByte(playerDetails->shuffleState);
+        endField(frame_shuffle, start, delta);
+
+        start = _length;
+        writeByte(playerDetails->repeateState);
+        endField(frame_repeat, start, delta);
+    }
+
+    if (_overflow)
+    {
+        // Some of the hashes are for fields that never went out
+        reset();
+        return 0;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        _buffer[3 + i] = (_fields >> (8 * i)) & 0xFF;
+    }
+
+    // An empty delta doesn't use up a sequence number, it doesn't need sending
+    if (_fields != 0)
+    {
+        _sequence++;
+    }
+    return _length;
+}
+
+void SpotifyFrameEncoder::endField(SpotifyFrameField field, size_t start, bool delta)
+{
+    if (_overflow)
+    {
+        return;
+    }
+
+    // FNV-1a of the field as encoded
+    uint32_t hash = 2166136261UL;
+    for (size_t i = start; i < _length; i++)
+    {
+        hash ^= _buffer[i];
+        hash *= 16777619UL;
+    }
+
+    uint32_t bit = 1UL << field;
+    if (delta && (_sent & bit) && _hashes[field] == hash)
+    {
+        // Unchanged, take it back out
+        _length = start;
+        return;
+    }
+
+    _hashes[field] = hash;
+    _sent |= bit;
+    _fields |= bit;
+}
+
+void SpotifyFrameEncoder::writeByte(uint8_t value)
+{
+    if (_length >= _size)
+    {
+        _overflow = true;
+        return;
+    }
+    _buffer[_length++] = value;
+}
+
+void SpotifyFrameEncoder::writeVarint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        writeByte((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    writeByte(value);
+}
+
+void SpotifyFrameEncoder::writeSigned(long value)
+{
+    // Zigzag, so small negative numbers stay small
+    writeVarint(((uint32_t)value << 1) ^ (uint32_t)(value < 0 ? -1 : 0));
+}
+
+void SpotifyFrameEncoder::writeString(const char *value)
+{
+    if (value == NULL)
+    {
+        writeVarint(0);
+        return;
+    }
+
+    size_t length = strlen(value);
+    writeVarint(length + 1);
+    if (_length + length + 1 > _size)
+    {
+        _overflow = true;
+        return;
+    }
+    memcpy(_buffer + _length, value, length + 1);
+    _length += length + 1;
+}
+
+bool SpotifyFrameDecoder::decode(const uint8_t *frame, size_t length, CurrentlyPlaying &currentlyPlaying, PlayerDetails &playerDetails)
+{
+    if (length < SPOTIFY_FRAME_HEADER_LENGTH || frame[0] != SPOTIFY_FRAME_VERSION)
+    {
+        return false;
+    }
+
+    _frame = frame;
+    _length = length;
+    _position = SPOTIFY_FRAME_HEADER_LENGTH;
+    _error = false;
+
+    uint32_t mask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        mask |= (uint32_t)frame[3 + i] << (8 * i);
+    }
+    if (mask >> frame_field_count)
+    {
+        // Fields from a newer version we can't skip over
+        return false;
+    }
+
+    // Worked on copies so a bad frame leaves the caller's structs alone
+    CurrentlyPlaying current = currentlyPlaying;
+    PlayerDetails player = playerDetails;
+    for (int field = 0; field < frame_field_count && !_error; field++)
+    {
+        if (!(mask & (1UL << field)))
+        {
+            continue;
+        }
+
+        int count;
+        switch (field)
+        {
+        case frame_track_name:
+            current.trackName = readString();
+            break;
+        case frame_track_uri:
+            current.trackUri = readString();
+            break;
+        case frame_artists:
+            count = readVarint();
+            if (count > SPOTIFY_MAX_NUM_ARTISTS)
+            {
+                _error = true;
+                break;
+            }
+            current.numArtists = count;
+            for (int i = 0; i < count; i++)
+            {
+                current.artists[i].artistName = readString();
+                current.artists[i].artistUri = NULL;
+            }
+            break;
+        case frame_album_name:
+            current.albumName = readString();
+            break;
+        case frame_album_uri:
+            current.albumUri = readString();
+            break;
+        case frame_album_images:
+            count = readVarint();
+            if (count > SPOTIFY_NUM_ALBUM_IMAGES)
+            {
+                _error = true;
+                break;
+            }
+            current.numImages = count;
+            for (int i = 0; i < count; i++)
+            {
+                current.albumImages[i].width = readVarint();
+                current.albumImages[i].height = readVarint();
+                current.albumImages[i].url = readString();
+            }
+            break;
+        case frame_context_uri:
+            current.contextUri = readString();
+            break;
+        case frame_playing_type:
+            current.currentlyPlayingType = (SpotifyPlayingType)readVarint();
+            break;
+        case frame_duration:
+            current.durationMs = readVarint();
+            break;
+        case frame_progress:
+            current.progressMs = player.progressMs = readSigned();
+            break;
+        case frame_is_playing:
+            current.isPlaying = player.isPlaying = readByte() != 0;
+            break;
+        case frame_device_id:
+            player.device.id = readString();
+            break;
+        case frame_device_name:
+            player.device.name = readString();
+            break;
+        case frame_device_type:
+            player.device.type = readString();
+            break;
+        case frame_device_flags:
+            count = readByte();
+            player.device.isActive = (count & 1) != 0;
+            player.device.isRestricted = (count & 2) != 0;
+            player.device.isPrivateSession = (count & 4) != 0;
+            break;
+        case frame_volume:
+            player.device.volumePercent = readSigned();
+            break;
+        case frame_shuffle:
+            player.shuffleState = readByte() != 0;
+            break;
+        case frame_repeat:
+            player.repeateState = (RepeatOptions)readByte();
+            break;
+        }
+    }
+
+    if (_error || _position != _length)
+    {
+        return false;
+    }
+
+    currentlyPlaying = current;
+    playerDetails = player;
+    fields = mask;
+    delta = (frame[1] & 1) != 0;
+
+    // Empty deltas don't use up a sequence number
+    if (mask != 0)
+    {
+        uint8_t sequence = frame[2];
+        missedFrame = delta && _lastSequence >= 0 && sequence != (uint8_t)(_lastSequence + 1);
+        _lastSequence = sequence;
+    }
+    return true;
+}
+
+uint8_t SpotifyFrameDecoder::readByte()
+{
+    if (_position >= _length)
+    {
+        _error = true;
+        return 0;
+    }
+    return _frame[_position++];
+}
+
+uint32_t SpotifyFrameDecoder::readVarint()
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        uint8_t b = readByte();
+        value |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            return value;
+        }
+    }
+
+    _error = true;
+    return 0;
+}
+
+long SpotifyFrameDecoder::readSigned()
+{
+    uint32_t value = readVarint();
+    return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+const char *SpotifyFrameDecoder::readString()
+{
+    uint32_t length = readVarint();
+    if (length == 0)
+    {
+        return NULL;
+    }
+
+    length--;
+    // Compared against what is left, a huge length can't wrap round past the end
+    if (_error || length >= _length - _position || _frame[_position + length] != '\0')
+    {
+        _error = true;
+        return NULL;
+    }
+
+    const char *value = (const char *)(_frame + _position);
+    _position += length + 1;
+    return value;
+}
@@ -0,0 +1,128 @@
+/*
+SpotifyFrame - Compact binary frames of the playback state, for passing
+it on to other boards over UART, ESP-NOW etc.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+
+#ifndef SpotifyFrame_h
+#define SpotifyFrame_h
+
+#include "SpotifyArduino.h"
+
+#define SPOTIFY_FRAME_VERSION 1
+#define SPOTIFY_FRAME_HEADER_LENGTH 7
+
+// Frame layout, all numbers are little endian base 128 varints:
+//   version byte, flags byte (bit 0 set for a delta), sequence byte,
+//   field mask (4 bytes, bit n set if field n is in the frame),
+//   then each field in the mask in order.
+// Strings are a varint of their length + 1 (0 for NULL), the bytes and a
+// terminating 0, so a decoded string can be used in place.
+enum SpotifyFrameField
+{
+  frame_track_name,
+  frame_track_uri,
+  frame_artists,      // Count, then each artist's name (not their URIs)
+  frame_album_name,
+  frame_album_uri,
+  frame_album_images, // Count, then width, height and url of each
+  frame_context_uri,
+  frame_playing_type,
+  frame_duration,
+  frame_progress,     // Zigzag encoded
+  frame_is_playing,
+  frame_device_id,
+  frame_device_name,
+  frame_device_type,
+  frame_device_flags, // Bit 0 active, bit 1 restricted, bit 2 private session
+  frame_volume,       // Zigzag encoded
+  frame_shuffle,
+  frame_repeat,
+  frame_field_count
+};
+
+// Writes frames into a buffer you own, never allocates. Keeps a hash of
+// every field it has sent, so delta frames only carry what changed.
+class SpotifyFrameEncoder
+{
+public:
+  SpotifyFrameEncoder() { reset(); }
+
+  // Every field of the struct, e.g. for a display that just joined.
+  // Each returns the frame length, or 0 if it didn't fit in size.
+  size_t encode(const CurrentlyPlaying &currentlyPlaying, uint8_t *buffer, size_t size) { return write(&currentlyPlaying, NULL, false, buffer, size); }
+  size_t encode(const PlayerDetails &playerDetails, uint8_t *buffer, size_t size) { return write(NULL, &playerDetails, false, buffer, size); }
+
+  // Only the fields that changed since they were last sent. If nothing did
+  // it's just the header, which there's no need to send.
+  size_t encodeDelta(const CurrentlyPlaying &currentlyPlaying, uint8_t *buffer, size_t size) { return write(&currentlyPlaying, NULL, true, buffer, size); }
+  size_t encodeDelta(const PlayerDetails &playerDetails, uint8_t *buffer, size_t size) { return write(NULL, &playerDetails, true, buffer, size); }
+
+  // Forget what was sent, the next delta carries every field
+  void reset();
+
+private:
+  uint32_t _hashes[frame_field_count];
+  uint32_t _sent;
+  uint8_t _sequence = 0;
+
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _length;
+  bool _overflow;
+  uint32_t _fields;
+
+  size_t write(const CurrentlyPlaying *currentlyPlaying, const PlayerDetails *playerDetails, bool delta, uint8_t *buffer, size_t size);
+  void endField(SpotifyFrameField field, size_t start, bool delta);
+  void writeByte(uint8_t value);
+  void writeVarint(uint32_t value);
+  void writeSigned(long value);
+  void writeString(const char *value);
+};
+
+// Reads frames straight out of the buffer they arrived in.
+class SpotifyFrameDecoder
+{
+public:
+  // Fills in only the fields that are in the frame, everything else is
+  // left as it was. Strings point into frame, so copy anything you want to
+  // keep before the buffer is reused. Returns false if the frame is
+  // malformed or from a different version.
+  bool decode(const uint8_t *frame, size_t length, CurrentlyPlaying &currentlyPlaying, PlayerDetails &playerDetails);
+
+  // What was in the last frame decoded, e.g. to only redraw what changed
+  bool has(SpotifyFrameField field) const { return (fields & (1UL << field)) != 0; }
+  uint32_t fields = 0;
+  bool delta = false;
+  bool missedFrame = false; // The sequence jumped, deltas from here on may leave fields stale until the next full frame
+
+private:
+  const uint8_t *_frame;
+  size_t _length;
+  size_t _position;
+  bool _error;
+  int _lastSequence = -1;
+
+  uint8_t readByte();
+  uint32_t readVarint();
+  long readSigned();
+  const char *readString();
+};
+
+#endif
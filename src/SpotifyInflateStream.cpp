@@ -0,0 +1,634 @@
+/*
+SpotifyInflateStream - Decompresses a gzip response body as it is read,
+so a compressed response can be handed straight to deserializeJson.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyInflateStream.h"
+
+// From RFC 1951, the base value and extra bits of each length and distance symbol
+static const uint16_t lengthBase[29] PROGMEM = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtraBits[29] PROGMEM = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] PROGMEM = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtraBits[30] PROGMEM = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t codeLengthOrder[19] PROGMEM = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// CRC-32 a nibble at a time, 64 bytes of table instead of 1KB
+static const uint32_t crcTable[16] PROGMEM = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+#define GZIP_FLAG_HEADER_CRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+#define GZIP_FLAG_RESERVED 0xe0
+
+SpotifyInflateStream::SpotifyInflateStream(uint8_t *window, size_t size)
+{
+    if (window == NULL)
+    {
+        window = (uint8_t *)malloc(size);
+        _ownsWindow = true;
+    }
+    _window = window;
+    _size = (window != NULL) ? size : 0;
+
+    // read() already waits on the source, Stream's own timeout would only add to it
+    setTimeout(0);
+}
+
+SpotifyInflateStream::~SpotifyInflateStream()
+{
+    if (_ownsWindow)
+    {
+        free(_window);
+    }
+}
+
+void SpotifyInflateStream::begin(Stream &source)
+{
+    _source = &source;
+    _position = 0;
+    _state = state_header;
+    _error = inflate_ok;
+    _lastBlock = false;
+    _bitBuffer = 0;
+    _bitCount = 0;
+    _storedRemaining = 0;
+    _matchLength = 0;
+    _matchDistance = 0;
+    _crc = 0xFFFFFFFF;
+    _peeked = -1;
+    bytesIn = 0;
+    bytesOut = 0;
+}
+
+int SpotifyInflateStream::available()
+{
+    if (_peeked >= 0 || _matchLength > 0)
+    {
+        return 1;
+    }
+    if (_state == state_done || _state == state_failed)
+    {
+        return 0;
+    }
+    return _source->available() > 0 ? 1 : 0;
+}
+
+int SpotifyInflateStream::peek()
+{
+    if (_peeked < 0)
+    {
+        _peeked = next();
+    }
+    return _peeked;
+}
+
+int SpotifyInflateStream::read()
+{
+    int c = peek();
+    _peeked = -1;
+    return c;
+}
+
+size_t SpotifyInflateStream::readBytes(char *buffer, size_t length)
+{
+    size_t total = 0;
+    while (total < length)
+    {
+        int c = read();
+        if (c < 0)
+        {
+            break;
+        }
+        buffer[total++] = (char)c;
+    }
+    return total;
+}
+
+int SpotifyInflateStream::next()
+{
+    while (true)
+    {
+        if (_matchLength > 0)
+        {
+            // Copy from the window, one byte at a time as the copy can overlap itself
+            _matchLength--;
+            size_t from = (_position >= _matchDistance) ? _position - _matchDistance : _position + _size - _matchDistance;
+            return output(_window[from]);
+        }
+
+        switch (_state)
+        {
+        case state_header:
+            if (!readHeader())
+            {
+                return fail(inflate_not_gzip);
+            }
+            _state = state_block;
+            break;
+
+        case state_block:
+            if (_lastBlock)
+            {
+                if (!readTrailer())
+                {
+                    return fail(inflate_checksum);
+                }
+                _state = state_done;
+                return -1;
+            }
+            if (!readBlockHeader())
+            {
+                return fail(inflate_corrupt);
+            }
+            break;
+
+        case state_stored:
+            if (_storedRemaining == 0)
+            {
+                _state = state_block;
+                break;
+            }
+            else
+            {
+                int c = readByte();
+                if (c < 0)
+                {
+                    return fail(inflate_truncated);
+                }
+                _storedRemaining--;
+                return output(c);
+            }
+
+        case state_huffman:
+        {
+            int symbol = decode(_literals.counts, _literals.symbols);
+            if (symbol < 0)
+            {
+                return fail(inflate_corrupt);
+            }
+            if (symbol < 256)
+            {
+                return output(symbol);
+            }
+            if (symbol == 256)
+            {
+                // End of block
+                _state = state_block;
+            }
+            else if (!readMatch(symbol))
+            {
+                return fail(inflate_corrupt);
+            }
+            break;
+        }
+
+        default:
+            return -1;
+        }
+    }
+}
+
+int SpotifyInflateStream::output(uint8_t c)
+{
+    _window[_position] = c;
+    if (++_position == _size)
+    {
+        _position = 0;
+    }
+    bytesOut++;
+
+    _crc ^= c;
+    _crc = (_crc >> 4) ^ pgm_read_dword(&crcTable[_crc & 0x0f]);
+    _crc = (_crc >> 4) ^ pgm_read_dword(&crcTable[_crc & 0x0f]);
+    return c;
+}
+
+int SpotifyInflateStream::fail(SpotifyInflateError error)
+{
+    // Keep the first, more specific, error, e.g. truncated rather than corrupt
+    if (_error == inflate_ok)
+    {
+        _error = error;
+    }
+    _state = state_failed;
+    return -1;
+}
+
+int SpotifyInflateStream::readByte()
+{
+    char c;
+    if (_source == NULL || _source->readBytes(&c, 1) != 1)
+    {
+        if (_error == inflate_ok)
+        {
+            _error = inflate_truncated;
+        }
+        return -1;
+    }
+    bytesIn++;
+    return (uint8_t)c;
+}
+
+int SpotifyInflateStream::readBits(uint8_t count)
+{
+    // Deflate packs its bits starting from the lowest bit of each byte
+    int value = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (_bitCount == 0)
+        {
+            int c = readByte();
+            if (c < 0)
+            {
+                return -1;
+            }
+            _bitBuffer = c;
+            _bitCount = 8;
+        }
+        value |= (_bitBuffer & 1) << i;
+        _bitBuffer >>= 1;
+        _bitCount--;
+    }
+    return value;
+}
+
+int SpotifyInflateStream::decode(const uint16_t *counts, const uint16_t *symbols)
+{
+    // Walks the canonical code a bit at a time, no lookup tables needed
+    int first = 0;
+    int code = 0;
+    for (uint8_t length = 1; length < 16; length++)
+    {
+        int bit = readBits(1);
+        if (bit < 0)
+        {
+            return -1;
+        }
+        code = (code << 1) | bit;
+        first += counts[length];
+        code -= counts[length];
+        if (code < 0)
+        {
+            return symbols[first + code];
+        }
+    }
+    return -1;
+}
+
+bool SpotifyInflateStream::buildTree(uint16_t *counts, uint16_t *symbols, const uint8_t *lengths, uint16_t numLengths)
+{
+    memset(counts, 0, sizeof(_literals.counts));
+    for (uint16_t i = 0; i < numLengths; i++)
+    {
+        counts[lengths[i]]++;
+    }
+    counts[0] = 0;
+
+    // More codes of a length than there is room for can't be decoded
+    int left = 1;
+    for (uint8_t length = 1; length < 16; length++)
+    {
+        left = (left << 1) - counts[length];
+        if (left < 0)
+        {
+            return false;
+        }
+    }
+
+    uint16_t offsets[16];
+    uint16_t total = 0;
+    for (uint8_t length = 0; length < 16; length++)
+    {
+        offsets[length] = total;
+        total += counts[length];
+    }
+    for (uint16_t i = 0; i < numLengths; i++)
+    {
+        if (lengths[i] != 0)
+        {
+            symbols[offsets[lengths[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+bool SpotifyInflateStream::readHeader()
+{
+    if (readByte() != 0x1f || readByte() != 0x8b || readByte() != 8)
+    {
+        return false;
+    }
+
+    int flags = readByte();
+    if (flags < 0 || (flags & GZIP_FLAG_RESERVED))
+    {
+        return false;
+    }
+
+    // Modification time, extra flags and OS
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        if (readByte() < 0)
+        {
+            return false;
+        }
+    }
+
+    if (flags & GZIP_FLAG_EXTRA)
+    {
+        int low = readByte();
+        int high = readByte();
+        if (low < 0 || high < 0)
+        {
+            return false;
+        }
+        for (int length = low | (high << 8); length > 0; length--)
+        {
+            if (readByte() < 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    for (uint8_t flag = GZIP_FLAG_NAME; flag <= GZIP_FLAG_COMMENT; flag <<= 1)
+    {
+        if (flags & flag)
+        {
+            int c;
+            while ((c = readByte()) > 0)
+            {
+            }
+            if (c < 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    if (flags & GZIP_FLAG_HEADER_CRC)
+    {
+        return readByte() >= 0 && readByte() >= 0;
+    }
+    return true;
+}
+
+bool SpotifyInflateStream::readBlockHeader()
+{
+    int header = readBits(3);
+    if (header < 0)
+    {
+        return false;
+    }
+    _lastBlock = header & 1;
+
+    switch (header >> 1)
+    {
+    case 0:
+    {
+        // Stored, starts on the next byte with its length and the length's complement
+        _bitCount = 0;
+        int length = readBits(16);
+        int complement = readBits(16);
+        if (length < 0 || complement < 0 || length != (~complement & 0xffff))
+        {
+            return false;
+        }
+        _storedRemaining = length;
+        _state = state_stored;
+        return true;
+    }
+    case 1:
+        useFixedTrees();
+        _state = state_huffman;
+        return true;
+    case 2:
+        if (!readDynamicTrees())
+        {
+            return false;
+        }
+        _state = state_huffman;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool SpotifyInflateStream::readDynamicTrees()
+{
+    int numLiterals = readBits(5);
+    int numDistances = readBits(5);
+    int numCodeLengths = readBits(4);
+    if (numLiterals < 0 || numDistances < 0 || numCodeLengths < 0)
+    {
+        return false;
+    }
+    numLiterals += 257;
+    numDistances += 1;
+    numCodeLengths += 4;
+    if (numLiterals > 286 || numDistances > 30)
+    {
+        return false;
+    }
+
+    // Only needed while the trees are built, so it lives on the stack
+    uint8_t lengths[286 + 30];
+    memset(lengths, 0, 19);
+    for (int i = 0; i < numCodeLengths; i++)
+    {
+        int length = readBits(3);
+        if (length < 0)
+        {
+            return false;
+        }
+        lengths[pgm_read_byte(&codeLengthOrder[i])] = length;
+    }
+
+    // The code lengths are themselves Huffman coded, borrow the distance tree for that
+    if (!buildTree(_distances.counts, _distances.symbols, lengths, 19))
+    {
+        return false;
+    }
+
+    int total = numLiterals + numDistances;
+    int index = 0;
+    while (index < total)
+    {
+        int symbol = decode(_distances.counts, _distances.symbols);
+        if (symbol < 0)
+        {
+            return false;
+        }
+        if (symbol < 16)
+        {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        uint8_t length = 0;
+        int repeat;
+        if (symbol == 16)
+        {
+            // Repeat the previous length 3-6 times
+            if (index == 0)
+            {
+                return false;
+            }
+            length = lengths[index - 1];
+            repeat = readBits(2) + 3;
+        }
+        else if (symbol == 17)
+        {
+            repeat = readBits(3) + 3;
+        }
+        else
+        {
+            repeat = readBits(7) + 11;
+        }
+
+        if (repeat < 3 || index + repeat > total)
+        {
+            return false;
+        }
+        memset(lengths + index, length, repeat);
+        index += repeat;
+    }
+
+    // Without an end of block code the block could never finish
+    if (lengths[256] == 0)
+    {
+        return false;
+    }
+
+    return buildTree(_literals.counts, _literals.symbols, lengths, numLiterals) &&
+           buildTree(_distances.counts, _distances.symbols, lengths + numLiterals, numDistances);
+}
+
+void SpotifyInflateStream::useFixedTrees()
+{
+    // RFC 1951 3.2.6, filled in directly instead of going through buildTree
+    memset(_literals.counts, 0, sizeof(_literals.counts));
+    _literals.counts[7] = 24;
+    _literals.counts[8] = 152;
+    _literals.counts[9] = 112;
+
+    uint16_t index = 0;
+    for (uint16_t symbol = 256; symbol < 280; symbol++)
+    {
+        _literals.symbols[index++] = symbol;
+    }
+    for (uint16_t symbol = 0; symbol < 144; symbol++)
+    {
+        _literals.symbols[index++] = symbol;
+    }
+    for (uint16_t symbol = 280; symbol < 288; symbol++)
+    {
+        _literals.symbols[index++] = symbol;
+    }
+    for (uint16_t symbol = 144; symbol < 256; symbol++)
+    {
+        _literals.symbols[index++] = symbol;
+    }
+
+    memset(_distances.counts, 0, sizeof(_distances.counts));
+    _distances.counts[5] = 32;
+    for (uint16_t symbol = 0; symbol < 32; symbol++)
+    {
+        _distances.symbols[symbol] = symbol;
+    }
+}
+
+bool SpotifyInflateStream::readMatch(int symbol)
+{
+    symbol -= 257;
+    if (symbol >= 29)
+    {
+        return false;
+    }
+    int extra = readBits(pgm_read_byte(&lengthExtraBits[symbol]));
+    if (extra < 0)
+    {
+        return false;
+    }
+    uint16_t length = pgm_read_word(&lengthBase[symbol]) + extra;
+
+    symbol = decode(_distances.counts, _distances.symbols);
+    if (symbol < 0 || symbol >= 30)
+    {
+        return false;
+    }
+    extra = readBits(pgm_read_byte(&distanceExtraBits[symbol]));
+    if (extra < 0)
+    {
+        return false;
+    }
+    uint16_t distance = pgm_read_word(&distanceBase[symbol]) + extra;
+
+    if (distance > bytesOut)
+    {
+        // Before the start of the stream
+        return false;
+    }
+    if (distance > _size)
+    {
+        _error = inflate_window_too_small;
+        return false;
+    }
+
+    _matchLength = length;
+    _matchDistance = distance;
+    return true;
+}
+
+bool SpotifyInflateStream::readTrailer()
+{
+    // The CRC-32 and length of the uncompressed data, starting on the next byte
+    _bitCount = 0;
+    uint32_t crc = 0;
+    uint32_t length = 0;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        int c = readByte();
+        if (c < 0)
+        {
+            return false;
+        }
+        if (i < 4)
+        {
+            crc |= (uint32_t)c << (8 * i);
+        }
+        else
+        {
+            length |= (uint32_t)c << (8 * (i - 4));
+        }
+    }
+    return crc == ~_crc && length == (uint32_t)bytesOut;
+}
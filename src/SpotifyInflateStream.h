@@ -0,0 +1,124 @@
+/*
+SpotifyInflateStream - Decompresses a gzip response body as it is read,
+so a compressed response can be handed straight to deserializeJson.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyInflateStream_h
+#define SpotifyInflateStream_h
+
+#include <Arduino.h>
+
+// Deflate can refer back up to 32KB, but never further back than the start
+// of the body. A window at least as big as the uncompressed body always
+// works, but a 50 track lookup is around 25KB and needed 24KB of window, so
+// the default is the full 32KB that no response can refer past.
+#define SPOTIFY_GZIP_WINDOW_SIZE 32768
+
+enum SpotifyInflateError
+{
+  inflate_ok,
+  inflate_not_gzip,
+  inflate_corrupt,
+  inflate_window_too_small, // Referred back further than the window, give it a bigger one
+  inflate_truncated,        // The source ran out before the end of the stream
+  inflate_checksum          // Read to the end, but the CRC or length didn't match
+};
+
+// Memory use is the window plus the object itself (around 750 bytes for
+// the Huffman tables), nothing is allocated while reading.
+class SpotifyInflateStream : public Stream
+{
+public:
+  // window is the history deflate refers back into, malloc'd here if NULL
+  SpotifyInflateStream(uint8_t *window, size_t size);
+  ~SpotifyInflateStream();
+  bool valid() { return _window != NULL; }
+  size_t windowSize() { return _size; }
+
+  void begin(Stream &source); // Start on a new gzip stream
+  SpotifyInflateError error() { return _error; }
+  bool finished() { return _state == state_done; } // Read to the end and the checksum matched
+
+  unsigned long bytesIn = 0;  // Compressed bytes taken from the source
+  unsigned long bytesOut = 0; // Bytes handed out after inflating
+
+  int available();
+  int read();
+  int peek();
+  size_t readBytes(char *buffer, size_t length);
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+  size_t write(uint8_t) { return 0; }
+
+private:
+  enum State
+  {
+    state_header,
+    state_block,
+    state_stored,
+    state_huffman,
+    state_done,
+    state_failed
+  };
+
+  // Canonical Huffman code, symbols sorted by code length
+  struct Tree
+  {
+    uint16_t counts[16];
+    uint16_t symbols[288];
+  };
+  struct DistanceTree
+  {
+    uint16_t counts[16];
+    uint16_t symbols[32];
+  };
+
+  Stream *_source = NULL;
+  uint8_t *_window;
+  bool _ownsWindow = false; // Malloc'd here, so freed here too
+  size_t _size;
+  size_t _position = 0;
+  State _state = state_done;
+  SpotifyInflateError _error = inflate_ok;
+  bool _lastBlock = false;
+  uint8_t _bitBuffer = 0;
+  uint8_t _bitCount = 0;
+  uint16_t _storedRemaining = 0;
+  uint16_t _matchLength = 0;
+  uint16_t _matchDistance = 0;
+  uint32_t _crc = 0;
+  int _peeked = -1;
+  Tree _literals;
+  DistanceTree _distances;
+
+  int next();
+  int output(uint8_t c);
+  int fail(SpotifyInflateError error);
+  int readByte();
+  int readBits(uint8_t count);
+  int decode(const uint16_t *counts, const uint16_t *symbols);
+  bool buildTree(uint16_t *counts, uint16_t *symbols, const uint8_t *lengths, uint16_t numLengths);
+  bool readHeader();
+  bool readBlockHeader();
+  bool readDynamicTrees();
+  void useFixedTrees();
+  bool readMatch(int symbol);
+  bool readTrailer();
+};
+
+#endif
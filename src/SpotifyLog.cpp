@@ -0,0 +1,91 @@
+/*
+SpotifyLog - Levelled logging for the SpotifyArduino library. Anything
+above SPOTIFY_LOG_LEVEL compiles to nothing, the rest goes to a sink.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyLog.h"
+
+static SpotifyPrintLogSink serialSink(Serial);
+SpotifyLogSink *SpotifyLog::_sink = &serialSink;
+
+void SpotifyPrintLogSink::log(uint8_t, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value)
+{
+    print(_out, message, argument, text, value);
+}
+
+void SpotifyPrintLogSink::print(Print &out, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value)
+{
+    out.print(message);
+    if (argument == log_argument_text)
+    {
+        out.print(text != NULL ? text : "(null)");
+    }
+    else if (argument == log_argument_value)
+    {
+        out.print(value);
+    }
+    out.println();
+}
+
+void SpotifyRingLogSink::log(uint8_t level, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value)
+{
+    if (_count >= SPOTIFY_LOG_RING_SIZE)
+    {
+        dropped++;
+        return;
+    }
+
+    Record &record = _records[(_head + _count) % SPOTIFY_LOG_RING_SIZE];
+    record.level = level;
+    record.message = message;
+    record.argument = argument;
+    record.value = value;
+    record.text[0] = '\0';
+    if (argument == log_argument_text && text != NULL)
+    {
+        strncpy(record.text, text, sizeof(record.text) - 1);
+        record.text[sizeof(record.text) - 1] = '\0';
+    }
+    _count++;
+}
+
+int SpotifyRingLogSink::flushTo(Print &out, int maxRecords)
+{
+    int flushed = 0;
+    while (_count > 0 && flushed < maxRecords)
+    {
+        Record &record = _records[_head];
+        SpotifyPrintLogSink::print(out, record.message, (SpotifyLogArgument)record.argument, record.text, record.value);
+        _head = (_head + 1) % SPOTIFY_LOG_RING_SIZE;
+        _count--;
+        flushed++;
+    }
+    return flushed;
+}
+
+size_t SpotifyLogBuffer::write(uint8_t c)
+{
+    if (_length >= sizeof(_buffer) - 1)
+    {
+        return 0;
+    }
+    _buffer[_length++] = c;
+    _buffer[_length] = '\0';
+    return 1;
+}
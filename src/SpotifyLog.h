@@ -0,0 +1,184 @@
+/*
+SpotifyLog - Levelled logging for the SpotifyArduino library. Anything
+above SPOTIFY_LOG_LEVEL compiles to nothing, the rest goes to a sink.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyLog_h
+#define SpotifyLog_h
+
+#include <Arduino.h>
+
+#define SPOTIFY_LOG_LEVEL_NONE 0
+#define SPOTIFY_LOG_LEVEL_ERROR 1
+#define SPOTIFY_LOG_LEVEL_INFO 2
+#define SPOTIFY_LOG_LEVEL_DEBUG 3
+
+// Can be set directly, otherwise it follows the older flags
+#ifndef SPOTIFY_LOG_LEVEL
+#if defined(SPOTIFY_DEBUG)
+#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_DEBUG
+#elif defined(SPOTIFY_SERIAL_OUTPUT)
+#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_ERROR // What the serial output used to print, failures only
+#else
+#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_NONE
+#endif
+#endif
+
+#define SPOTIFY_LOG_RING_SIZE 16      // Records held by SpotifyRingLogSink
+#define SPOTIFY_LOG_TEXT_LENGTH 48    // Text kept per record by SpotifyRingLogSink
+#define SPOTIFY_LOG_BUFFER_LENGTH 200 // Longest JSON/request body shown at debug level
+
+enum SpotifyLogArgument
+{
+  log_argument_none,
+  log_argument_text,
+  log_argument_value
+};
+
+class SpotifyLogSink
+{
+public:
+  // message is in flash and always valid, text is only valid for the duration of the call
+  virtual void log(uint8_t level, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value) = 0;
+};
+
+// Prints each record as it happens, this is what the old Serial output did
+class SpotifyPrintLogSink : public SpotifyLogSink
+{
+public:
+  SpotifyPrintLogSink(Print &out) : _out(out) {}
+  void log(uint8_t level, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value);
+  static void print(Print &out, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value);
+
+private:
+  Print &_out;
+};
+
+// Only copies records into a fixed ring, formatting happens later in
+// flushTo (e.g. from loop when nothing else is going on). Never blocks,
+// records are dropped when it's full.
+class SpotifyRingLogSink : public SpotifyLogSink
+{
+public:
+  void log(uint8_t level, const __FlashStringHelper *message, SpotifyLogArgument argument, const char *text, long value);
+  int flushTo(Print &out, int maxRecords = SPOTIFY_LOG_RING_SIZE);
+  unsigned long dropped = 0;
+
+private:
+  struct Record
+  {
+    const __FlashStringHelper *message;
+    long value;
+    uint8_t level;
+    uint8_t argument;
+    char text[SPOTIFY_LOG_TEXT_LENGTH];
+  };
+  Record _records[SPOTIFY_LOG_RING_SIZE];
+  uint8_t _head = 0;
+  uint8_t _count = 0;
+};
+
+// Print that fills a fixed buffer, used to hand JSON and request bodies to the sink as text
+class SpotifyLogBuffer : public Print
+{
+public:
+  size_t write(uint8_t c);
+  const char *c_str() { return _buffer; }
+
+private:
+  char _buffer[SPOTIFY_LOG_BUFFER_LENGTH] = "";
+  size_t _length = 0;
+};
+
+class SpotifyLog
+{
+public:
+  static void setSink(SpotifyLogSink *sink) { _sink = sink; } // NULL turns logging off at runtime
+
+  static void write(uint8_t level, const __FlashStringHelper *message)
+  {
+    if (_sink != NULL)
+      _sink->log(level, message, log_argument_none, NULL, 0);
+  }
+  static void write(uint8_t level, const __FlashStringHelper *message, const char *text)
+  {
+    if (_sink != NULL)
+      _sink->log(level, message, log_argument_text, text, 0);
+  }
+  static void write(uint8_t level, const __FlashStringHelper *message, long value)
+  {
+    if (_sink != NULL)
+      _sink->log(level, message, log_argument_value, NULL, value);
+  }
+
+private:
+  static SpotifyLogSink *_sink;
+};
+
+// The arguments are not evaluated when the level is compiled out
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_ERROR
+#define SPOTIFY_LOG_ERROR(message, ...) SpotifyLog::write(SPOTIFY_LOG_LEVEL_ERROR, F(message), ##__VA_ARGS__)
+#else
+#define SPOTIFY_LOG_ERROR(message, ...) \
+  do                                    \
+  {                                     \
+  } while (0)
+#endif
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_INFO
+#define SPOTIFY_LOG_INFO(message, ...) SpotifyLog::write(SPOTIFY_LOG_LEVEL_INFO, F(message), ##__VA_ARGS__)
+#else
+#define SPOTIFY_LOG_INFO(message, ...) \
+  do                                   \
+  {                                    \
+  } while (0)
+#endif
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_DEBUG
+#define SPOTIFY_LOG_DEBUG(message, ...) SpotifyLog::write(SPOTIFY_LOG_LEVEL_DEBUG, F(message), ##__VA_ARGS__)
+#define SPOTIFY_LOG_JSON(doc)                              \
+  do                                                       \
+  {                                                        \
+    SpotifyLogBuffer logBuffer;                            \
+    serializeJson(doc, logBuffer);                         \
+    SPOTIFY_LOG_DEBUG("JSON: ", logBuffer.c_str());        \
+  } while (0)
+#define SPOTIFY_LOG_BODY(body)                             \
+  do                                                       \
+  {                                                        \
+    SpotifyLogBuffer logBuffer;                            \
+    (body).writeBody(logBuffer);                           \
+    SPOTIFY_LOG_DEBUG("Body: ", logBuffer.c_str());        \
+  } while (0)
+#else
+#define SPOTIFY_LOG_DEBUG(message, ...) \
+  do                                    \
+  {                                     \
+  } while (0)
+#define SPOTIFY_LOG_JSON(doc) \
+  do                          \
+  {                           \
+  } while (0)
+#define SPOTIFY_LOG_BODY(body) \
+  do                           \
+  {                            \
+  } while (0)
+#endif
+
+#endif
@@ -0,0 +1,485 @@
+/*
+SpotifyNetworkSimulator - A Client that replays recorded responses under
+simulated network conditions, plus a runner that reports how the library
+behaves under them. Meant for host-side testing, include it explicitly.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyNetworkSimulator_h
+#define SpotifyNetworkSimulator_h
+
+#include "SpotifyArduino.h"
+
+#define SPOTIFY_SIMULATOR_MAX_RESPONSES 8
+#define SPOTIFY_SCENARIO_MAX_RUNS 100
+#define SPOTIFY_SIMULATOR_MAX_TICKETS 8 // Sessions the simulated server remembers, oldest are forgotten first
+#define SPOTIFY_SIMULATOR_MAX_SESSIONS 4 // Hosts SpotifySimulatedSessionStore keeps a session for
+
+struct SpotifyNetworkConditions
+{
+  unsigned long connectLatencyMs = 0;
+  unsigned long segmentLatencyMs = 0; // Delay before each segment of the response becomes available
+  unsigned long bytesPerSecond = 0;   // 0 is unlimited
+  int minSegmentSize = 1460;
+  int maxSegmentSize = 1460;
+  uint8_t stallPercent = 0; // Chance per segment of a stall
+  unsigned long stallMs = 0;
+  uint8_t resetPercent = 0;        // Chance per segment of the connection being reset
+  uint8_t connectFailPercent = 0;  // Chance per connect of it failing
+  unsigned long fullHandshakeMs = 0;    // TLS stand-in, time a handshake without a usable session takes
+  unsigned long resumedHandshakeMs = 0; // and with one
+  uint8_t ticketRejectPercent = 0;      // Chance per offered session of the server refusing it anyway
+};
+
+class SpotifySimulatedClient : public Client
+{
+public:
+  SpotifyNetworkConditions conditions;
+
+  SpotifySimulatedClient(uint32_t seed = 1) { reset(seed); }
+
+  // Responses are replayed in order, one per connect, and wrap around.
+  // They must include the status line and headers.
+  bool addResponse(const char *response) { return addResponse((const uint8_t *)response, strlen(response)); }
+  bool addResponse(const uint8_t *response, size_t length)
+  {
+    if (_numResponses >= SPOTIFY_SIMULATOR_MAX_RESPONSES)
+    {
+      return false;
+    }
+    _responses[_numResponses] = response;
+    _responseLengths[_numResponses] = length;
+    _numResponses++;
+    return true;
+  }
+
+  void reset(uint32_t seed)
+  {
+    _seed = (seed == 0) ? 1 : seed;
+    _nextResponse = 0;
+    _open = false;
+    connects = connectFailures = resets = stalls = 0;
+    bytesRead = bytesWritten = 0;
+    fullHandshakes = resumedHandshakes = 0;
+    memset(_serverTickets, 0, sizeof(_serverTickets));
+    _nextTicket = 0;
+    _offeredTicket = _ticket = 0;
+    _resumed = false;
+  }
+
+  // The session side of the TLS stand-in, what a real client would do with
+  // session IDs or tickets
+  void offerTicket(uint32_t ticket) { _offeredTicket = ticket; }
+  uint32_t sessionTicket() const { return _ticket; }
+  bool sessionResumed() const { return _resumed; }
+
+  // Counters, all cumulative since the last reset
+  unsigned long connects;
+  unsigned long connectFailures;
+  unsigned long resets;
+  unsigned long stalls;
+  unsigned long bytesRead;
+  unsigned long bytesWritten;
+  unsigned long fullHandshakes;
+  unsigned long resumedHandshakes;
+
+  int connect(IPAddress ip, uint16_t port) { return connect("", port); }
+  int connect(const char *host, uint16_t port)
+  {
+    connects++;
+    delay(conditions.connectLatencyMs);
+    if (_numResponses == 0 || chance(conditions.connectFailPercent))
+    {
+      connectFailures++;
+      return 0;
+    }
+
+    handshake(host);
+
+    _current = _responses[_nextResponse];
+    _currentLength = _responseLengths[_nextResponse];
+    _nextResponse = (_nextResponse + 1) % _numResponses;
+    _position = 0;
+    _segmentRemaining = 0;
+    _open = true;
+    return 1;
+  }
+
+  size_t write(uint8_t b) { return write(&b, 1); }
+  size_t write(const uint8_t *buf, size_t size)
+  {
+    if (!_open)
+    {
+      return 0;
+    }
+    bytesWritten += size;
+    return size;
+  }
+
+  int available()
+  {
+    if (!_open || _position >= _currentLength)
+    {
+      return 0;
+    }
+
+    if (_segmentRemaining == 0 && !nextSegment())
+    {
+      return 0;
+    }
+
+    return _segmentRemaining;
+  }
+
+  int read()
+  {
+    uint8_t b;
+    return (read(&b, 1) == 1) ? b : -1;
+  }
+
+  int read(uint8_t *buf, size_t size)
+  {
+    int count = available();
+    if (count <= 0)
+    {
+      return -1;
+    }
+    if ((size_t)count > size)
+    {
+      count = size;
+    }
+    memcpy(buf, _current + _position, count);
+    _position += count;
+    _segmentRemaining -= count;
+    bytesRead += count;
+    return count;
+  }
+
+  int peek() { return (available() > 0) ? _current[_position] : -1; }
+  void flush() {}
+  void stop() { _open = false; }
+
+  // Like a real socket the server closes after the response (HTTP/1.0),
+  // but unread data still counts as connected.
+  uint8_t connected() { return _open && _position < _currentLength; }
+  operator bool() { return _open; }
+
+private:
+  const uint8_t *_responses[SPOTIFY_SIMULATOR_MAX_RESPONSES];
+  size_t _responseLengths[SPOTIFY_SIMULATOR_MAX_RESPONSES];
+  int _numResponses = 0;
+  int _nextResponse = 0;
+
+  const uint8_t *_current = NULL;
+  size_t _currentLength = 0;
+  size_t _position = 0;
+  int _segmentRemaining = 0;
+  bool _open = false;
+  uint32_t _seed;
+
+  struct ServerTicket
+  {
+    uint32_t hostHash;
+    uint32_t ticket;
+  };
+  ServerTicket _serverTickets[SPOTIFY_SIMULATOR_MAX_TICKETS];
+  int _nextTicket = 0;
+  uint32_t _offeredTicket = 0;
+  uint32_t _ticket = 0;
+  bool _resumed = false;
+
+  void handshake(const char *host)
+  {
+    uint32_t hostHash = 2166136261UL;
+    for (const char *c = host; *c != '\0'; c++)
+    {
+      hostHash = (hostHash ^ (uint8_t)*c) * 16777619UL;
+    }
+
+    _resumed = false;
+    if (_offeredTicket != 0 && !chance(conditions.ticketRejectPercent))
+    {
+      for (int i = 0; i < SPOTIFY_SIMULATOR_MAX_TICKETS; i++)
+      {
+        if (_serverTickets[i].ticket == _offeredTicket && _serverTickets[i].hostHash == hostHash)
+        {
+          _resumed = true;
+          break;
+        }
+      }
+    }
+    _offeredTicket = 0;
+
+    if (_resumed)
+    {
+      resumedHandshakes++;
+      delay(conditions.resumedHandshakeMs);
+      return;
+    }
+
+    fullHandshakes++;
+    delay(conditions.fullHandshakeMs);
+    _ticket = nextRandom() | 1;
+    _serverTickets[_nextTicket].hostHash = hostHash;
+    _serverTickets[_nextTicket].ticket = _ticket;
+    _nextTicket = (_nextTicket + 1) % SPOTIFY_SIMULATOR_MAX_TICKETS;
+  }
+
+  bool nextSegment()
+  {
+    if (chance(conditions.resetPercent))
+    {
+      resets++;
+      _open = false;
+      return false;
+    }
+
+    if (chance(conditions.stallPercent))
+    {
+      stalls++;
+      delay(conditions.stallMs);
+    }
+
+    int size = conditions.minSegmentSize;
+    if (conditions.maxSegmentSize > conditions.minSegmentSize)
+    {
+      size += nextRandom() % (conditions.maxSegmentSize - conditions.minSegmentSize + 1);
+    }
+    if (size < 1)
+    {
+      size = 1;
+    }
+    if ((size_t)size > _currentLength - _position)
+    {
+      size = _currentLength - _position;
+    }
+
+    unsigned long wait = conditions.segmentLatencyMs;
+    if (conditions.bytesPerSecond > 0)
+    {
+      wait += ((unsigned long)size * 1000UL) / conditions.bytesPerSecond;
+    }
+    delay(wait);
+
+    _segmentRemaining = size;
+    return true;
+  }
+
+  // xorshift32, so runs are repeatable for a given seed on every platform
+  uint32_t nextRandom()
+  {
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+    return _seed;
+  }
+
+  bool chance(uint8_t percent) { return percent > 0 && (nextRandom() % 100) < percent; }
+};
+
+// Session store for the simulated client, keeps one ticket per host
+class SpotifySimulatedSessionStore : public SpotifyTlsSessionStore
+{
+public:
+  SpotifySimulatedSessionStore(SpotifySimulatedClient &client) : _client(client) { memset(_sessions, 0, sizeof(_sessions)); }
+
+  void offerSession(const char *host)
+  {
+    Session *session = find(host, false);
+    if (session != NULL)
+    {
+      _client.offerTicket(session->ticket);
+    }
+  }
+
+  bool saveSession(const char *host)
+  {
+    Session *session = find(host, true);
+    strncpy(session->host, host, sizeof(session->host) - 1);
+    session->ticket = _client.sessionTicket();
+    return _client.sessionResumed();
+  }
+
+private:
+  struct Session
+  {
+    char host[64];
+    uint32_t ticket;
+  };
+  Session _sessions[SPOTIFY_SIMULATOR_MAX_SESSIONS];
+  int _next = 0;
+  SpotifySimulatedClient &_client;
+
+  Session *find(const char *host, bool create)
+  {
+    for (int i = 0; i < SPOTIFY_SIMULATOR_MAX_SESSIONS; i++)
+    {
+      if (strncmp(_sessions[i].host, host, sizeof(_sessions[i].host) - 1) == 0)
+      {
+        return &_sessions[i];
+      }
+    }
+
+    if (!create)
+    {
+      return NULL;
+    }
+    Session *session = &_sessions[_next];
+    memset(session, 0, sizeof(Session));
+    _next = (_next + 1) % SPOTIFY_SIMULATOR_MAX_SESSIONS;
+    return session;
+  }
+};
+
+enum SpotifyFailureMode
+{
+  failure_none,
+  failure_connect,
+  failure_reset,
+  failure_timeout,
+  failure_status,
+  failure_mode_count
+};
+
+// Runs one public method of the library, returns its status code (true/false methods can return 204/-1)
+typedef int (*spotifyScenarioStep)(SpotifyArduino &spotify);
+
+struct SpotifyScenarioResult
+{
+  const char *name;
+  int runs;
+  unsigned long minMs;
+  unsigned long p50Ms;
+  unsigned long p90Ms;
+  unsigned long p99Ms;
+  unsigned long maxMs;
+  int failures[failure_mode_count];
+  unsigned long fullHandshakes;
+  unsigned long resumedHandshakes;
+};
+
+class SpotifyScenarioRunner
+{
+public:
+  SpotifyScenarioRunner(SpotifyArduino &spotify, SpotifySimulatedClient &client) : _spotify(spotify), _client(client) {}
+
+  SpotifyScenarioResult run(const char *name, spotifyScenarioStep step, int runs)
+  {
+    SpotifyScenarioResult result = {};
+    result.name = name;
+    if (runs > SPOTIFY_SCENARIO_MAX_RUNS)
+    {
+      runs = SPOTIFY_SCENARIO_MAX_RUNS;
+    }
+    result.runs = runs;
+    unsigned long fullHandshakes = _client.fullHandshakes;
+    unsigned long resumedHandshakes = _client.resumedHandshakes;
+
+    for (int i = 0; i < runs; i++)
+    {
+      unsigned long connectFailures = _client.connectFailures;
+      unsigned long resets = _client.resets;
+
+      unsigned long start = millis();
+      int statusCode = step(_spotify);
+      unsigned long elapsed = millis() - start;
+
+      // Insertion sort as we go, runs are small
+      int j = i;
+      while (j > 0 && _samples[j - 1] > elapsed)
+      {
+        _samples[j] = _samples[j - 1];
+        j--;
+      }
+      _samples[j] = elapsed;
+
+      if (_client.connectFailures != connectFailures)
+      {
+        result.failures[failure_connect]++;
+      }
+      else if (_client.resets != resets)
+      {
+        result.failures[failure_reset]++;
+      }
+      else if (statusCode >= 200 && statusCode < 300)
+      {
+        result.failures[failure_none]++;
+      }
+      else if (elapsed >= SPOTIFY_TIMEOUT)
+      {
+        result.failures[failure_timeout]++;
+      }
+      else
+      {
+        result.failures[failure_status]++;
+      }
+    }
+
+    result.fullHandshakes = _client.fullHandshakes - fullHandshakes;
+    result.resumedHandshakes = _client.resumedHandshakes - resumedHandshakes;
+
+    if (runs > 0)
+    {
+      result.minMs = _samples[0];
+      result.p50Ms = _samples[(runs - 1) * 50 / 100];
+      result.p90Ms = _samples[(runs - 1) * 90 / 100];
+      result.p99Ms = _samples[(runs - 1) * 99 / 100];
+      result.maxMs = _samples[runs - 1];
+    }
+
+    return result;
+  }
+
+  static void printResult(const SpotifyScenarioResult &result, Print &out)
+  {
+    out.print(result.name);
+    out.print(F(": runs="));
+    out.print(result.runs);
+    out.print(F(" min="));
+    out.print(result.minMs);
+    out.print(F(" p50="));
+    out.print(result.p50Ms);
+    out.print(F(" p90="));
+    out.print(result.p90Ms);
+    out.print(F(" p99="));
+    out.print(result.p99Ms);
+    out.print(F(" max="));
+    out.print(result.maxMs);
+    out.print(F("ms ok="));
+    out.print(result.failures[failure_none]);
+    out.print(F(" connect="));
+    out.print(result.failures[failure_connect]);
+    out.print(F(" reset="));
+    out.print(result.failures[failure_reset]);
+    out.print(F(" timeout="));
+    out.print(result.failures[failure_timeout]);
+    out.print(F(" status="));
+    out.print(result.failures[failure_status]);
+    out.print(F(" handshakes full="));
+    out.print(result.fullHandshakes);
+    out.print(F(" resumed="));
+    out.println(result.resumedHandshakes);
+  }
+
+private:
+  SpotifyArduino &_spotify;
+  SpotifySimulatedClient &_client;
+  unsigned long _samples[SPOTIFY_SCENARIO_MAX_RUNS];
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+SpotifyPlaybackTracker - Keeps the last known playback state and
+reports only the fields that changed between polls.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPlaybackTracker.h"
+
+void SpotifyPlaybackTracker::update(const CurrentlyPlaying &currentlyPlaying)
+{
+    uint32_t trackHash = hash(currentlyPlaying.trackUri);
+    bool trackChanged = !_hasTrack || trackHash != _trackHash;
+    if (trackChanged)
+    {
+        _trackHash = trackHash;
+        _durationMs = currentlyPlaying.durationMs;
+        _hasTrack = true;
+        if (trackChangedCallback != NULL)
+        {
+            trackChangedCallback(currentlyPlaying);
+        }
+    }
+
+    updatePlayState(currentlyPlaying.isPlaying);
+    updateProgress(currentlyPlaying.progressMs, trackChanged);
+}
+
+void SpotifyPlaybackTracker::update(const PlayerDetails &playerDetails)
+{
+    uint32_t deviceHash = hash(playerDetails.device.id);
+    if (!_hasPlayer || deviceHash != _deviceHash)
+    {
+        _deviceHash = deviceHash;
+        if (deviceChangedCallback != NULL)
+        {
+            deviceChangedCallback(playerDetails.device);
+        }
+    }
+
+    if (!_hasPlayer || playerDetails.device.volumePercent != _volumePercent)
+    {
+        _volumePercent = playerDetails.device.volumePercent;
+        if (volumeChangedCallback != NULL)
+        {
+            volumeChangedCallback(playerDetails.device.volumePercent);
+        }
+    }
+
+    if (!_hasPlayer || playerDetails.shuffleState != _shuffleState || playerDetails.repeateState != _repeatState)
+    {
+        _shuffleState = playerDetails.shuffleState;
+        _repeatState = playerDetails.repeateState;
+        if (shuffleRepeatChangedCallback != NULL)
+        {
+            shuffleRepeatChangedCallback(playerDetails.shuffleState, playerDetails.repeateState);
+        }
+    }
+
+    _hasPlayer = true;
+    updatePlayState(playerDetails.isPlaying);
+
+    // Player details don't know the track duration, so only report progress once a track is known
+    if (_hasTrack)
+    {
+        updateProgress(playerDetails.progressMs, false);
+    }
+}
+
+void SpotifyPlaybackTracker::reset()
+{
+    _hasTrack = false;
+    _hasPlayState = false;
+    _hasPlayer = false;
+}
+
+void SpotifyPlaybackTracker::updatePlayState(bool isPlaying)
+{
+    if (!_hasPlayState || isPlaying != _isPlaying)
+    {
+        _isPlaying = isPlaying;
+        _hasPlayState = true;
+        if (playStateChangedCallback != NULL)
+        {
+            playStateChangedCallback(isPlaying);
+        }
+    }
+}
+
+void SpotifyPlaybackTracker::updateProgress(long progressMs, bool force)
+{
+    if (force || labs(progressMs - _progressMs) >= progressResolutionMs)
+    {
+        _progressMs = progressMs;
+        if (progressCallback != NULL)
+        {
+            progressCallback(progressMs, _durationMs);
+        }
+    }
+}
+
+uint32_t SpotifyPlaybackTracker::hash(const char *value)
+{
+    // FNV-1a, NULL and "" hash to the same value
+    uint32_t result = 2166136261UL;
+    if (value != NULL)
+    {
+        while (*value)
+        {
+            result ^= (uint8_t)*value++;
+            result *= 16777619UL;
+        }
+    }
+
+    return result;
+}
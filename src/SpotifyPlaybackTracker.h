@@ -0,0 +1,73 @@
+/*
+SpotifyPlaybackTracker - Keeps the last known playback state and
+reports only the fields that changed between polls.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPlaybackTracker_h
+#define SpotifyPlaybackTracker_h
+
+#include "SpotifyArduino.h"
+
+typedef void (*onTrackChanged)(CurrentlyPlaying currentlyPlaying);
+typedef void (*onPlayStateChanged)(bool isPlaying);
+typedef void (*onVolumeChanged)(int volumePercent);
+typedef void (*onDeviceChanged)(SpotifyDevice device);
+typedef void (*onShuffleRepeatChanged)(bool shuffleState, RepeatOptions repeatState);
+typedef void (*onProgress)(long progressMs, long durationMs);
+
+class SpotifyPlaybackTracker
+{
+public:
+  // Feed these from the getCurrentlyPlaying/getPlayerDetails callbacks
+  void update(const CurrentlyPlaying &currentlyPlaying);
+  void update(const PlayerDetails &playerDetails);
+
+  // Forget the last known state, the next update fires every event again
+  void reset();
+
+  // Any of these can be left NULL
+  onTrackChanged trackChangedCallback = NULL;
+  onPlayStateChanged playStateChangedCallback = NULL;
+  onVolumeChanged volumeChangedCallback = NULL;
+  onDeviceChanged deviceChangedCallback = NULL;
+  onShuffleRepeatChanged shuffleRepeatChangedCallback = NULL;
+  onProgress progressCallback = NULL;
+
+  long progressResolutionMs = 1000; // onProgress only fires once progress moves by at least this much
+
+private:
+  // URIs and IDs are kept as hashes so the tracker stays small
+  uint32_t _trackHash = 0;
+  uint32_t _deviceHash = 0;
+  long _progressMs = 0;
+  long _durationMs = 0;
+  int8_t _volumePercent = -1;
+  uint8_t _repeatState = repeat_off;
+  bool _isPlaying = false;
+  bool _shuffleState = false;
+  bool _hasTrack = false;
+  bool _hasPlayState = false;
+  bool _hasPlayer = false;
+
+  void updatePlayState(bool isPlaying);
+  void updateProgress(long progressMs, bool force);
+  static uint32_t hash(const char *value);
+};
+
+#endif
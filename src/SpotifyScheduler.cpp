@@ -0,0 +1,157 @@
+/*
+SpotifyScheduler - Runs the sketch's requests in priority order, so a
+player command never has to wait behind a long album art download.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyScheduler.h"
+
+SpotifyScheduler::SpotifyScheduler(SpotifyArduino &spotify)
+    : _spotify(spotify)
+{
+}
+
+bool SpotifyScheduler::submit(SpotifyPriority priority, SpotifyJob job, void *context, onJobComplete complete)
+{
+    Queue &queue = _queues[priority];
+    if (queue.count >= SPOTIFY_SCHEDULER_QUEUE_SIZE)
+    {
+        stats[priority].dropped++;
+        SPOTIFY_LOG_ERROR("Scheduler queue full, priority: ", (int)priority);
+        return false;
+    }
+
+    Entry &entry = queue.entries[(queue.head + queue.count) % SPOTIFY_SCHEDULER_QUEUE_SIZE];
+    entry.job = job;
+    entry.context = context;
+    entry.complete = complete;
+    entry.submittedAt = millis();
+    entry.restarts = 0;
+    queue.count++;
+    stats[priority].submitted++;
+
+    if (priority <= preemptsUpTo)
+    {
+        preempt();
+    }
+    return true;
+}
+
+void SpotifyScheduler::preempt()
+{
+    SpotifyPriority running = _running;
+    if (running != priority_count && running > preemptsUpTo)
+    {
+        _preempted = true;
+        _cancelToken.cancel();
+    }
+}
+
+bool SpotifyScheduler::idle() const
+{
+    if (isRunning())
+    {
+        return false;
+    }
+
+    for (int i = 0; i < priority_count; i++)
+    {
+        if (_queues[i].count > 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpotifyScheduler::run()
+{
+    for (int i = 0; i < priority_count; i++)
+    {
+        Queue &queue = _queues[i];
+        if (queue.count == 0)
+        {
+            continue;
+        }
+
+        SpotifyPriority priority = (SpotifyPriority)i;
+        Entry entry = queue.entries[queue.head];
+        queue.head = (queue.head + 1) % SPOTIFY_SCHEDULER_QUEUE_SIZE;
+        queue.count--;
+
+        SpotifySchedulerStats &classStats = stats[priority];
+        classStats.run++;
+        if (entry.restarts == 0)
+        {
+            // Restarts don't count again, it's the delay since it was submitted
+            unsigned long delayMs = millis() - entry.submittedAt;
+            classStats.lastQueueDelayMs = delayMs;
+            classStats.totalQueueDelayMs += delayMs;
+            if (delayMs > classStats.maxQueueDelayMs)
+            {
+                classStats.maxQueueDelayMs = delayMs;
+            }
+        }
+
+        // The sketch's token still cancels the job, it just isn't restarted
+        SpotifyCancelToken *sketchCancelToken = _spotify.cancelToken;
+        _cancelToken.reset();
+        _cancelToken.parent = sketchCancelToken;
+        _preempted = false;
+        _spotify.cancelToken = &_cancelToken;
+        _running = priority;
+
+        int result = entry.job(_spotify, entry.context);
+
+        _running = priority_count;
+        _spotify.cancelToken = sketchCancelToken;
+        _cancelToken.parent = NULL;
+
+        // A preempt that came in just after the job's last request finished
+        // didn't cut anything short, the job is done
+        if (_preempted && _spotify.getLastRequestEnd() == request_cancelled)
+        {
+            classStats.preempted++;
+            SPOTIFY_LOG_INFO("Job preempted, priority: ", (int)priority);
+            if (entry.restarts < maxRestarts && queue.count < SPOTIFY_SCHEDULER_QUEUE_SIZE)
+            {
+                // Back to the front of its queue, it goes again once the
+                // more important work is done
+                entry.restarts++;
+                queue.head = (queue.head + SPOTIFY_SCHEDULER_QUEUE_SIZE - 1) % SPOTIFY_SCHEDULER_QUEUE_SIZE;
+                queue.entries[queue.head] = entry;
+                queue.count++;
+                return true;
+            }
+            classStats.dropped++;
+        }
+
+        finish(priority, entry, result);
+        return true;
+    }
+
+    return false;
+}
+
+void SpotifyScheduler::finish(SpotifyPriority priority, const Entry &entry, int result)
+{
+    if (entry.complete != NULL)
+    {
+        entry.complete(priority, result, entry.context);
+    }
+}
@@ -0,0 +1,121 @@
+/*
+SpotifyScheduler - Runs the sketch's requests in priority order, so a
+player command never has to wait behind a long album art download.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyScheduler_h
+#define SpotifyScheduler_h
+
+#include "SpotifyArduino.h"
+
+#define SPOTIFY_SCHEDULER_QUEUE_SIZE 4 // Per priority
+
+// Highest first
+enum SpotifyPriority
+{
+  priority_interactive, // Player controls
+  priority_metadata,    // Currently playing/player details polls
+  priority_art,         // Album art downloads
+  priority_prefetch,    // Anything that's only getting ahead
+  priority_count
+};
+
+// A job makes whatever requests it likes through spotify. It may be run more
+// than once if it gets preempted, so it has to be safe to start over.
+typedef int (*SpotifyJob)(SpotifyArduino &spotify, void *context);
+
+// Called once a job is finished with for good, result is whatever the job
+// returned (or what it was on its last attempt if it was dropped)
+typedef void (*onJobComplete)(SpotifyPriority priority, int result, void *context);
+
+struct SpotifySchedulerStats
+{
+  unsigned long submitted;
+  unsigned long run; // Including restarts after being preempted
+  unsigned long preempted;
+  unsigned long dropped; // Queue was full, or it was preempted more than maxRestarts times
+  unsigned long lastQueueDelayMs; // From submit until it first started
+  unsigned long maxQueueDelayMs;
+  unsigned long totalQueueDelayMs; // Divide by run - preempted for the average
+};
+
+// Call run() from loop(). It takes the highest priority job waiting and
+// runs it to the end. If a more important job comes in while a less
+// important one is running, the running request is cancelled, the job is put
+// back at the front of its queue, and the more important one goes next.
+//
+// submit() must be called from the same task as run(), which includes from
+// inside a job's own callbacks (e.g. an image sink checking buttons). From an
+// interrupt, call preempt() and submit the command once run() returns.
+//
+// While a job runs, the scheduler's cancel token is set as spotify.cancelToken,
+// with the sketch's own one as its parent so cancelling that still stops the
+// job. The sketch's token is put back afterwards.
+class SpotifyScheduler
+{
+public:
+  SpotifyScheduler(SpotifyArduino &spotify);
+
+  bool submit(SpotifyPriority priority, SpotifyJob job, void *context = NULL, onJobComplete complete = NULL);
+
+  // Runs one job, returns false if there was nothing to do
+  bool run();
+
+  // Cancels the running job if it's less important than preemptsUpTo.
+  // Safe from an interrupt.
+  void preempt();
+
+  bool idle() const;
+  int waiting(SpotifyPriority priority) const { return _queues[priority].count; }
+  bool isRunning() const { return _running != priority_count; }
+
+  // Jobs submitted at this priority or higher preempt anything running below
+  // it. Only player commands by default, a metadata poll waits for the art.
+  SpotifyPriority preemptsUpTo = priority_interactive;
+  int maxRestarts = 3;
+
+  SpotifySchedulerStats stats[priority_count] = {};
+
+private:
+  struct Entry
+  {
+    SpotifyJob job;
+    void *context;
+    onJobComplete complete;
+    unsigned long submittedAt;
+    uint8_t restarts;
+  };
+
+  struct Queue
+  {
+    Entry entries[SPOTIFY_SCHEDULER_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+  };
+
+  SpotifyArduino &_spotify;
+  Queue _queues[priority_count] = {};
+  SpotifyCancelToken _cancelToken;
+  volatile SpotifyPriority _running = priority_count;
+  volatile bool _preempted = false;
+
+  void finish(SpotifyPriority priority, const Entry &entry, int result);
+};
+
+#endif
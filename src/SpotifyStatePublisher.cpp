@@ -0,0 +1,141 @@
+/*
+SpotifyStatePublisher - Publishes the latest playback state as a
+versioned snapshot that other tasks/cores can copy without locks.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyStatePublisher.h"
+
+SpotifyStatePublisher::SpotifyStatePublisher()
+{
+    memset(_slots, 0, sizeof(_slots));
+    _slots[0].snapshot.repeatState = repeat_off;
+    _slots[0].snapshot.volumePercent = -1;
+}
+
+void SpotifyStatePublisher::update(const CurrentlyPlaying &currentlyPlaying)
+{
+    SpotifyPlaybackSnapshot &snapshot = beginWrite();
+
+    snapshot.hasTrack = currentlyPlaying.trackUri != NULL;
+    copyString(snapshot.trackName, currentlyPlaying.trackName, sizeof(snapshot.trackName));
+    copyString(snapshot.trackUri, currentlyPlaying.trackUri, sizeof(snapshot.trackUri));
+    copyString(snapshot.albumName, currentlyPlaying.albumName, sizeof(snapshot.albumName));
+    copyString(snapshot.albumUri, currentlyPlaying.albumUri, sizeof(snapshot.albumUri));
+    copyString(snapshot.contextUri, currentlyPlaying.contextUri, sizeof(snapshot.contextUri));
+
+    memset(snapshot.artistNames, 0, sizeof(snapshot.artistNames));
+    for (int i = 0; i < currentlyPlaying.numArtists; i++)
+    {
+        size_t length = strlen(snapshot.artistNames);
+        if (i > 0 && length + 2 < sizeof(snapshot.artistNames))
+        {
+            strcpy(snapshot.artistNames + length, ", ");
+            length += 2;
+        }
+        copyString(snapshot.artistNames + length, currentlyPlaying.artists[i].artistName, sizeof(snapshot.artistNames) - length);
+    }
+
+    int imageIndex = SpotifyArduino::closestImageIndex((SpotifyImage *)currentlyPlaying.albumImages, currentlyPlaying.numImages, imageWidth);
+    copyString(snapshot.imageUrl, imageIndex >= 0 ? currentlyPlaying.albumImages[imageIndex].url : NULL, sizeof(snapshot.imageUrl));
+
+    snapshot.currentlyPlayingType = currentlyPlaying.currentlyPlayingType;
+    snapshot.durationMs = currentlyPlaying.durationMs;
+    snapshot.isPlaying = currentlyPlaying.isPlaying;
+    snapshot.progressMs = currentlyPlaying.progressMs;
+
+    endWrite();
+}
+
+void SpotifyStatePublisher::update(const PlayerDetails &playerDetails)
+{
+    SpotifyPlaybackSnapshot &snapshot = beginWrite();
+
+    snapshot.hasPlayer = true;
+    copyString(snapshot.deviceId, playerDetails.device.id, sizeof(snapshot.deviceId));
+    copyString(snapshot.deviceName, playerDetails.device.name, sizeof(snapshot.deviceName));
+    snapshot.volumePercent = playerDetails.device.volumePercent;
+    snapshot.shuffleState = playerDetails.shuffleState;
+    snapshot.repeatState = playerDetails.repeateState;
+    snapshot.isPlaying = playerDetails.isPlaying;
+    snapshot.progressMs = playerDetails.progressMs;
+
+    endWrite();
+}
+
+void SpotifyStatePublisher::read(SpotifyPlaybackSnapshot &snapshot) const
+{
+    while (true)
+    {
+        const Slot &slot = _slots[_current];
+        uint32_t sequence = slot.sequence;
+        __sync_synchronize();
+        if ((sequence & 1) == 0)
+        {
+            memcpy(&snapshot, &slot.snapshot, sizeof(snapshot));
+            __sync_synchronize();
+            if (slot.sequence == sequence)
+            {
+                return;
+            }
+        }
+    }
+}
+
+SpotifyPlaybackSnapshot &SpotifyStatePublisher::beginWrite()
+{
+    Slot &slot = _slots[_current ^ 1];
+    slot.sequence = slot.sequence + 1;
+    __sync_synchronize();
+
+    // Start from what's published, each update only fills in its own fields
+    memcpy(&slot.snapshot, &_slots[_current].snapshot, sizeof(slot.snapshot));
+    return slot.snapshot;
+}
+
+void SpotifyStatePublisher::endWrite()
+{
+    uint8_t next = _current ^ 1;
+    Slot &slot = _slots[next];
+
+    // Nothing changed, leave the version alone so readers can skip the frame
+    slot.snapshot.publishedAtMs = _slots[_current].snapshot.publishedAtMs;
+    bool changed = memcmp(&slot.snapshot, &_slots[_current].snapshot, sizeof(slot.snapshot)) != 0;
+    if (changed)
+    {
+        slot.snapshot.version = _version + 1;
+        slot.snapshot.publishedAtMs = millis();
+    }
+
+    __sync_synchronize();
+    slot.sequence = slot.sequence + 1;
+    __sync_synchronize();
+
+    if (changed)
+    {
+        _current = next;
+        _version = slot.snapshot.version;
+    }
+}
+
+void SpotifyStatePublisher::copyString(char *destination, const char *source, size_t size)
+{
+    // strncpy pads with zeros, so unchanged strings compare equal in endWrite
+    strncpy(destination, source != NULL ? source : "", size - 1);
+    destination[size - 1] = '\0';
+}
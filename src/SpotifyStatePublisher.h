@@ -0,0 +1,92 @@
+/*
+SpotifyStatePublisher - Publishes the latest playback state as a
+versioned snapshot that other tasks/cores can copy without locks.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyStatePublisher_h
+#define SpotifyStatePublisher_h
+
+#include "SpotifyArduino.h"
+
+// Unlike CurrentlyPlaying/PlayerDetails everything here is a copy, so it
+// stays valid for as long as you keep it.
+struct SpotifyPlaybackSnapshot
+{
+  uint32_t version; // Goes up by one every time anything in here changes
+  unsigned long publishedAtMs; // millis() when progressMs was read, add the time since to animate progress
+
+  bool hasTrack;
+  char trackName[SPOTIFY_NAME_CHAR_LENGTH];
+  char trackUri[SPOTIFY_URI_CHAR_LENGTH];
+  char artistNames[SPOTIFY_NAME_CHAR_LENGTH]; // All artists, separated by ", "
+  char albumName[SPOTIFY_NAME_CHAR_LENGTH];
+  char albumUri[SPOTIFY_URI_CHAR_LENGTH];
+  char imageUrl[SPOTIFY_URL_CHAR_LENGTH]; // The album image closest to SpotifyStatePublisher::imageWidth
+  char contextUri[SPOTIFY_URI_CHAR_LENGTH];
+  SpotifyPlayingType currentlyPlayingType;
+  long durationMs;
+
+  bool isPlaying;
+  long progressMs;
+
+  bool hasPlayer;
+  char deviceId[SPOTIFY_DEVICE_ID_CHAR_LENGTH];
+  char deviceName[SPOTIFY_DEVICE_NAME_CHAR_LENGTH];
+  int volumePercent;
+  bool shuffleState;
+  RepeatOptions repeatState;
+};
+
+class SpotifyStatePublisher
+{
+public:
+  SpotifyStatePublisher();
+
+  // Called by SpotifyArduino after every parse once set as its statePublisher,
+  // or feed them yourself. Only ever from one task at a time.
+  void update(const CurrentlyPlaying &currentlyPlaying);
+  void update(const PlayerDetails &playerDetails);
+
+  // Safe from any task or core. Never blocks the writer, retries the copy
+  // in the unlikely case the writer published twice while it was copying.
+  void read(SpotifyPlaybackSnapshot &snapshot) const;
+
+  // Cheap check to skip a frame when nothing changed since your last read
+  uint32_t version() const { return _version; }
+
+  int imageWidth = 300;
+
+private:
+  // The writer only ever fills the slot readers aren't being pointed at.
+  // A slot's sequence is odd while it's being written.
+  struct Slot
+  {
+    volatile uint32_t sequence;
+    SpotifyPlaybackSnapshot snapshot;
+  };
+  Slot _slots[2];
+  volatile uint8_t _current = 0;
+  volatile uint32_t _version = 0;
+
+  SpotifyPlaybackSnapshot &beginWrite();
+  void endWrite();
+  static void copyString(char *destination, const char *source, size_t size);
+};
+
+#endif
@@ -0,0 +1,407 @@
+/*
+SpotifyWorker - Gives one thread sole ownership of a SpotifyArduino
+instance (and its client), other threads hand it requests through a
+bounded lock-free queue. Needs std::thread, so ESP32 or a Linux host
+only, include it explicitly.
+
+Copyright (c) 2021  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyWorker_h
+#define SpotifyWorker_h
+
+#if defined(ESP8266)
+#error "SpotifyWorker needs std::thread, which the ESP8266 doesn't have"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <thread>
+
+#if defined(ESP32)
+#include <esp_pthread.h>
+#endif
+
+#include "SpotifyArduino.h"
+
+#define SPOTIFY_WORKER_QUEUE_SIZE 8 // Must be a power of two
+#define SPOTIFY_WORKER_CANCELLED INT_MIN // Result of a request still queued when stop() was called, no status code uses it
+
+// Bounded queue that any number of threads can push to and one thread pops
+// from, without locks. Each cell carries a sequence number saying whose turn
+// it is, so a push never waits on a pop and vice versa.
+template <typename T, size_t N>
+class SpotifyCommandQueue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpotifyCommandQueue size must be a power of two");
+
+public:
+  SpotifyCommandQueue()
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _pushPos.store(0, std::memory_order_relaxed);
+    _popPos.store(0, std::memory_order_relaxed);
+  }
+
+  // Returns false straight away when full, it never blocks
+  bool push(const T &item)
+  {
+    Cell *cell;
+    size_t pos = _pushPos.load(std::memory_order_relaxed);
+    while (true)
+    {
+      cell = &_cells[pos & (N - 1)];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+      if (diff == 0)
+      {
+        if (_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false;
+      }
+      else
+      {
+        pos = _pushPos.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->data = item;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only ever call this from the one consumer thread
+  bool pop(T &item)
+  {
+    size_t pos = _popPos.load(std::memory_order_relaxed);
+    Cell *cell = &_cells[pos & (N - 1)];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0)
+    {
+      return false;
+    }
+
+    item = cell->data;
+    cell->sequence.store(pos + N, std::memory_order_release);
+    _popPos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+  Cell _cells[N];
+  std::atomic<size_t> _pushPos;
+  std::atomic<size_t> _popPos;
+};
+
+// Filled in by the worker when a request finishes. The submitting thread
+// owns it and must keep it alive until it's done.
+class SpotifyWorkerFuture
+{
+public:
+  bool ready() const { return _done.load(std::memory_order_acquire); }
+
+  // Whatever the matching SpotifyArduino method returned, a status code for
+  // the get methods or 1/0 for the player controls, or SPOTIFY_WORKER_CANCELLED
+  int result() const { return _result; }
+  bool cancelled() const { return ready() && _result == SPOTIFY_WORKER_CANCELLED; }
+
+  // Blocks the calling thread. Returns false if it timed out or the request
+  // was cancelled, otherwise result is set to what the request returned.
+  bool wait(int &result, unsigned long timeoutMs = SPOTIFY_TIMEOUT * 4)
+  {
+    auto start = std::chrono::steady_clock::now();
+    while (!ready())
+    {
+      if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(timeoutMs))
+      {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    result = _result;
+    return _result != SPOTIFY_WORKER_CANCELLED;
+  }
+
+  void reset() { _done.store(false, std::memory_order_release); }
+
+  void complete(int result)
+  {
+    _result = result;
+    _done.store(true, std::memory_order_release);
+  }
+
+private:
+  std::atomic<bool> _done{false};
+  int _result = -1;
+};
+
+enum SpotifyWorkerCommandType
+{
+  worker_refresh_token,
+  worker_currently_playing,
+  worker_player_details,
+  worker_devices,
+  worker_play,
+  worker_pause,
+  worker_next,
+  worker_previous,
+  worker_volume,
+  worker_shuffle,
+  worker_repeat,
+  worker_seek,
+  worker_transfer
+};
+
+// result is SPOTIFY_WORKER_CANCELLED for a request stop() dropped
+typedef void (*onWorkerComplete)(SpotifyWorkerCommandType type, int result, void *context);
+
+struct SpotifyWorkerCommand
+{
+  SpotifyWorkerCommandType type;
+  int value; // Volume, seek position, shuffle/repeat state, transfer's play flag or refresh number
+  char deviceId[SPOTIFY_DEVICE_ID_CHAR_LENGTH];
+  // The data callbacks run on the worker thread, copy out what you need
+  union
+  {
+    processCurrentlyPlaying currentlyPlaying;
+    processPlayerDetails playerDetails;
+    processDevices devices;
+  } callback;
+  onWorkerComplete complete;
+  void *context;
+  SpotifyWorkerFuture *future;
+};
+
+class SpotifyWorker
+{
+public:
+  SpotifyWorker(SpotifyArduino &spotify) : _spotify(spotify) {}
+  ~SpotifyWorker() { stop(); }
+
+  unsigned long idleSleepMs = 5; // How long the worker sleeps when there's nothing queued
+  size_t workerStackSize = 12288; // TLS needs far more than the default pthread stack on ESP32
+
+  // Starts a thread that owns the SpotifyArduino instance. Once started, don't
+  // call it directly from any other thread.
+  bool start()
+  {
+    if (_running.load())
+    {
+      return false;
+    }
+#if defined(ESP32)
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.stack_size = workerStackSize;
+    esp_pthread_set_cfg(&cfg);
+#endif
+    _running.store(true);
+    _thread = std::thread(&SpotifyWorker::run, this);
+    return true;
+  }
+
+  // Lets the request in progress finish, anything still queued is completed
+  // with SPOTIFY_WORKER_CANCELLED without being sent
+  void stop()
+  {
+    if (_running.exchange(false) && _thread.joinable())
+    {
+      _thread.join();
+
+      // The worker thread has gone, so this is the only consumer now
+      SpotifyWorkerCommand command;
+      while (_queue.pop(command))
+      {
+        finish(command, SPOTIFY_WORKER_CANCELLED);
+      }
+    }
+  }
+
+  // Runs one queued request on the calling thread, for when you already have
+  // a network task and don't want start() to make another. Returns false if
+  // the queue was empty.
+  bool process()
+  {
+    SpotifyWorkerCommand command;
+    if (!_queue.pop(command))
+    {
+      return false;
+    }
+
+    finish(command, execute(command));
+    return true;
+  }
+
+  // Every submit method is safe to call from any thread. They return false if
+  // the queue is full, in which case nothing was queued.
+
+  // Refreshes asked for before the worker gets to one are all answered by
+  // that one, only the first goes over the network. Each caller still gets
+  // its own future and callback.
+  bool refreshAccessToken(SpotifyWorkerFuture *future = NULL, onWorkerComplete complete = NULL, void *context = NULL)
+  {
+    // Numbered so the worker can tell which ones a refresh already covers
+    unsigned int request = _refreshRequests.fetch_add(1, std::memory_order_acq_rel) + 1;
+    return _queue.push(makeCommand(worker_refresh_token, (int)request, "", future, complete, context));
+  }
+
+  bool getCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, SpotifyWorkerFuture *future = NULL, onWorkerComplete complete = NULL, void *context = NULL)
+  {
+    SpotifyWorkerCommand command = makeCommand(worker_currently_playing, 0, "", future, complete, context);
+    command.callback.currentlyPlaying = currentlyPlayingCallback;
+    return _queue.push(command);
+  }
+
+  bool getPlayerDetails(processPlayerDetails playerDetailsCallback, SpotifyWorkerFuture *future = NULL, onWorkerComplete complete = NULL, void *context = NULL)
+  {
+    SpotifyWorkerCommand command = makeCommand(worker_player_details, 0, "", future, complete, context);
+    command.callback.playerDetails = playerDetailsCallback;
+    return _queue.push(command);
+  }
+
+  bool getDevices(processDevices devicesCallback, SpotifyWorkerFuture *future = NULL, onWorkerComplete complete = NULL, void *context = NULL)
+  {
+    SpotifyWorkerCommand command = makeCommand(worker_devices, 0, "", future, complete, context);
+    command.callback.devices = devicesCallback;
+    return _queue.push(command);
+  }
+
+  bool submit(SpotifyWorkerCommandType type, int value = 0, const char *deviceId = "", SpotifyWorkerFuture *future = NULL, onWorkerComplete complete = NULL, void *context = NULL)
+  {
+    if (type == worker_refresh_token || type == worker_currently_playing || type == worker_player_details || type == worker_devices)
+    {
+      // These have their own methods
+      return false;
+    }
+    return _queue.push(makeCommand(type, value, deviceId, future, complete, context));
+  }
+
+  bool play(const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_play, 0, deviceId, future); }
+  bool pause(const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_pause, 0, deviceId, future); }
+  bool nextTrack(const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_next, 0, deviceId, future); }
+  bool previousTrack(const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_previous, 0, deviceId, future); }
+  bool setVolume(int volume, const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_volume, volume, deviceId, future); }
+  bool toggleShuffle(bool shuffle, const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_shuffle, shuffle, deviceId, future); }
+  bool setRepeatMode(RepeatOptions repeat, const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_repeat, repeat, deviceId, future); }
+  bool seek(int position, const char *deviceId = "", SpotifyWorkerFuture *future = NULL) { return submit(worker_seek, position, deviceId, future); }
+  bool transferPlayback(const char *deviceId, bool play = false, SpotifyWorkerFuture *future = NULL) { return submit(worker_transfer, play, deviceId, future); }
+
+private:
+  SpotifyArduino &_spotify;
+  SpotifyCommandQueue<SpotifyWorkerCommand, SPOTIFY_WORKER_QUEUE_SIZE> _queue;
+  std::atomic<bool> _running{false};
+  std::atomic<unsigned int> _refreshRequests{0};
+  unsigned int _refreshCovers = 0; // Worker side only, the last request number the last refresh answers
+  int _refreshResult = 0;
+  std::thread _thread;
+
+  static SpotifyWorkerCommand makeCommand(SpotifyWorkerCommandType type, int value, const char *deviceId, SpotifyWorkerFuture *future, onWorkerComplete complete, void *context)
+  {
+    SpotifyWorkerCommand command;
+    command.type = type;
+    command.value = value;
+    strncpy(command.deviceId, deviceId, sizeof(command.deviceId) - 1);
+    command.deviceId[sizeof(command.deviceId) - 1] = '\0';
+    command.callback.currentlyPlaying = NULL;
+    command.complete = complete;
+    command.context = context;
+    command.future = future;
+    if (future != NULL)
+    {
+      future->reset();
+    }
+    return command;
+  }
+
+  int execute(SpotifyWorkerCommand &command)
+  {
+    switch (command.type)
+    {
+    case worker_refresh_token:
+      if ((int)((unsigned int)command.value - _refreshCovers) > 0)
+      {
+        // Anyone asking from now on has to wait for the next one
+        _refreshCovers = _refreshRequests.load(std::memory_order_acquire);
+        _refreshResult = _spotify.refreshAccessToken();
+      }
+      return _refreshResult;
+    case worker_currently_playing:
+      return _spotify.getCurrentlyPlaying(command.callback.currentlyPlaying);
+    case worker_player_details:
+      return _spotify.getPlayerDetails(command.callback.playerDetails);
+    case worker_devices:
+      return _spotify.getDevices(command.callback.devices);
+    case worker_play:
+      return _spotify.play(command.deviceId);
+    case worker_pause:
+      return _spotify.pause(command.deviceId);
+    case worker_next:
+      return _spotify.nextTrack(command.deviceId);
+    case worker_previous:
+      return _spotify.previousTrack(command.deviceId);
+    case worker_volume:
+      return _spotify.setVolume(command.value, command.deviceId);
+    case worker_shuffle:
+      return _spotify.toggleShuffle(command.value != 0, command.deviceId);
+    case worker_repeat:
+      return _spotify.setRepeatMode((RepeatOptions)command.value, command.deviceId);
+    case worker_seek:
+      return _spotify.seek(command.value, command.deviceId);
+    case worker_transfer:
+      return _spotify.transferPlayback(command.deviceId, command.value != 0);
+    }
+    return -1;
+  }
+
+  void finish(SpotifyWorkerCommand &command, int result)
+  {
+    if (command.future != NULL)
+    {
+      command.future->complete(result);
+    }
+    if (command.complete != NULL)
+    {
+      command.complete(command.type, result, command.context);
+    }
+  }
+
+  void run()
+  {
+    while (_running.load(std::memory_order_acquire))
+    {
+      if (!process())
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(idleSleepMs));
+      }
+    }
+  }
+};
+
+#endif